@@ -0,0 +1,27 @@
+#include "alloc_check.h"
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+static std::atomic <size_t> allocations(0);
+
+size_t allocations_count()
+{
+    return allocations;
+}
+
+void * operator new(size_t size)
+{
+    ++allocations;
+    void * p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void * p) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,42 @@
+#ifndef ALLOC_CHECK_H
+#define ALLOC_CHECK_H
+
+#include <ostream>
+#include <cstddef>
+
+#define ALLOC_CHECK_WARMUP 1000
+
+// Number of heap allocations made by the process so far. Only available in
+// builds with ALLOC_CHECK defined (make alloc_check).
+size_t allocations_count();
+
+// Counts reads after the warm-up which made any heap allocation
+class AllocCheck
+{
+public:
+    AllocCheck() : reads(0), allocating_reads(0), last(0) {}
+
+    void update()
+    {
+        size_t now = allocations_count();
+        if (++reads > ALLOC_CHECK_WARMUP && now != last) {
+            ++allocating_reads;
+        }
+        last = now;
+    }
+
+    // Returns false if some reads allocated in steady state
+    bool report(std::ostream & out) const
+    {
+        out << "reads with heap allocations after " << ALLOC_CHECK_WARMUP << " reads warm-up: "
+            << allocating_reads << " of " << (reads > ALLOC_CHECK_WARMUP ? reads - ALLOC_CHECK_WARMUP : 0) << std::endl;
+        return allocating_reads == 0;
+    }
+
+private:
+    size_t reads;
+    size_t allocating_reads;
+    size_t last;
+};
+
+#endif // ALLOC_CHECK_H
@@ -0,0 +1,282 @@
+#include "discover.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "encode.h"
+
+#define BLOCK_SIZE (1 << DISCOVER_BLOCK_BITS)
+#define ROW_SIZE (BLOCK_SIZE / DISCOVER_SKETCH_DEPTH)
+
+// odd multipliers of the multiply-shift hashes choosing the block of a kmer
+// and its counters in the block
+static const uint64_t block_seed = 0x9E3779B97F4A7C15ULL;
+static const uint64_t counter_seed = 0xC2B2AE3D27D4EB4FULL;
+
+static const uint64_t kmer_mask = (DISCOVER_K < 32) ? (1ULL << (2 * DISCOVER_K)) - 1 : ~0ULL;
+
+KmerDiscovery::KmerDiscovery()
+    : sketch(((size_t)1 << DISCOVER_SKETCH_BITS) + BLOCK_SIZE), top_index(DISCOVER_TOP_SLOTS, 0),
+      kmers(DISCOVER_TAIL), blocks(DISCOVER_TAIL), reads(0)
+{
+    size_t misalignment = ((size_t)&sketch[0] / sizeof(uint32_t)) % BLOCK_SIZE;
+    sketch_begin = misalignment ? BLOCK_SIZE - misalignment : 0;
+    top.reserve(DISCOVER_TOP);
+}
+
+void KmerDiscovery::add(const unsigned char * codes, size_t size)
+{
+    ++reads;
+    size_t len = std::min(size, (size_t)DISCOVER_TAIL);
+    codes += size - len;
+
+    // collect the kmers and prefetch their blocks first, so that the cache
+    // misses of a read overlap
+    size_t kmers_count = 0;
+    uint64_t kmer = 0;
+    size_t valid = 0; // bases since the last N
+    for (size_t i = 0; i < len; ++i) {
+        if (codes[i] > code_T) {
+            valid = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | codes[i]) & kmer_mask;
+        if (++valid < DISCOVER_K) {
+            continue;
+        }
+        size_t block = ((kmer * block_seed) >> (64 - DISCOVER_SKETCH_BITS + DISCOVER_BLOCK_BITS)) << DISCOVER_BLOCK_BITS;
+        __builtin_prefetch(&sketch[sketch_begin + block]);
+        kmers[kmers_count] = kmer;
+        blocks[kmers_count] = block;
+        ++kmers_count;
+    }
+
+    for (size_t i = 0; i < kmers_count; ++i) {
+        uint32_t * block = &sketch[sketch_begin + blocks[i]];
+        uint64_t offsets = kmers[i] * counter_seed;
+        uint32_t count = ~0U;
+        // every row has its own ROW_SIZE counters of the block
+        for (size_t row = 0; row < DISCOVER_SKETCH_DEPTH; ++row) {
+            count = std::min(count, ++block[row * ROW_SIZE + ((offsets >> (56 - row * 8)) % ROW_SIZE)]);
+        }
+        update_top(kmers[i], count);
+    }
+}
+
+void KmerDiscovery::update_top(uint64_t kmer, uint32_t estimate)
+{
+    // most kmers are rare, so check the cheapest way out first. Estimates
+    // only grow, so a kept kmer never takes it
+    if (top.size() >= DISCOVER_TOP && estimate <= top[0].estimate) {
+        return;
+    }
+    size_t slot = find_slot(kmer);
+    if (top_index[slot]) {
+        size_t i = top_index[slot] - 1;
+        top[i].estimate = estimate;
+        ++top[i].count;
+        sift_down(i);
+        return;
+    }
+    if (top.size() >= DISCOVER_TOP) {
+        // the smallest estimate makes room, its slot may be refilled by the erase
+        erase_slot(top[0].slot);
+        HeavyHitter last = top.back();
+        top.pop_back();
+        if (!top.empty()) {
+            place(0, last);
+            sift_down(0);
+        }
+        slot = find_slot(kmer);
+    }
+    HeavyHitter hitter;
+    hitter.kmer = kmer;
+    hitter.estimate = estimate;
+    hitter.count = 1;
+    hitter.slot = slot;
+    top.push_back(hitter);
+    top_index[slot] = top.size();
+    sift_up(top.size() - 1);
+}
+
+// Slot of the kmer in the index, or the empty slot it would take
+size_t KmerDiscovery::find_slot(uint64_t kmer) const
+{
+    size_t mask = DISCOVER_TOP_SLOTS - 1;
+    size_t slot = (size_t)((kmer * block_seed) >> 32) & mask;
+    while (top_index[slot] && top[top_index[slot] - 1].kmer != kmer) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Empties a slot of the index, moving later kmers of its probe chain back
+// so that find_slot still reaches them
+void KmerDiscovery::erase_slot(size_t slot)
+{
+    size_t mask = DISCOVER_TOP_SLOTS - 1;
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (!top_index[next]) {
+            break;
+        }
+        HeavyHitter & hitter = top[top_index[next] - 1];
+        size_t home = (size_t)((hitter.kmer * block_seed) >> 32) & mask;
+        // the kmer can move back unless its home is cyclically in (slot, next]
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            top_index[slot] = top_index[next];
+            hitter.slot = slot;
+            slot = next;
+        }
+    }
+    top_index[slot] = 0;
+}
+
+void KmerDiscovery::place(size_t i, HeavyHitter const & hitter)
+{
+    top[i] = hitter;
+    top_index[hitter.slot] = i + 1;
+}
+
+void KmerDiscovery::sift_up(size_t i)
+{
+    HeavyHitter hitter = top[i];
+    while (i > 0 && hitter.estimate < top[(i - 1) / 2].estimate) {
+        place(i, top[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    place(i, hitter);
+}
+
+void KmerDiscovery::sift_down(size_t i)
+{
+    HeavyHitter hitter = top[i];
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= top.size()) {
+            break;
+        }
+        if (child + 1 < top.size() && top[child + 1].estimate < top[child].estimate) {
+            ++child;
+        }
+        if (top[child].estimate >= hitter.estimate) {
+            break;
+        }
+        place(i, top[child]);
+        i = child;
+    }
+    place(i, hitter);
+}
+
+// Base of a kmer, 0 for the first one
+static inline uint64_t kmer_base(uint64_t kmer, size_t pos)
+{
+    return (kmer >> (2 * (DISCOVER_K - 1 - pos))) & 3;
+}
+
+static bool low_complexity(uint64_t kmer)
+{
+    bool seen[4] = {false, false, false, false};
+    for (size_t i = 0; i < DISCOVER_K; ++i) {
+        seen[kmer_base(kmer, i)] = true;
+    }
+    return seen[0] + seen[1] + seen[2] + seen[3] < 3;
+}
+
+// Kmer overlapping the given one by K - 1 bases, on its right or left side
+static inline uint64_t neighbour(uint64_t kmer, uint64_t base, bool right)
+{
+    return right ? (((kmer << 2) | base) & kmer_mask) : ((kmer >> 2) | (base << (2 * (DISCOVER_K - 1))));
+}
+
+// True if the kmer is a side branch of an already written candidate, i.e.
+// it overlaps one of its kmers that is much more frequent
+static bool branches_off(uint64_t kmer, uint32_t count, std::unordered_map <uint64_t, uint32_t> const & used)
+{
+    for (uint64_t base = 0; base < 4; ++base) {
+        for (int right = 0; right < 2; ++right) {
+            auto found = used.find(neighbour(kmer, base, right));
+            if (found != used.end() && count < found->second * DISCOVER_EXTEND_FRACTION) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+size_t KmerDiscovery::write(std::ostream & out) const
+{
+    uint32_t min_count = std::max((uint32_t)DISCOVER_MIN_COUNT, (uint32_t)(reads * DISCOVER_MIN_FRACTION));
+    // exact counts only: a kmer seen fewer than min_count times is never
+    // reported, whatever its estimate
+    std::unordered_map <uint64_t, uint32_t> frequent;
+    for (auto it = top.begin(); it != top.end(); ++it) {
+        if (it->count >= min_count) {
+            frequent[it->kmer] = it->count;
+        }
+    }
+
+    // seeds from the most frequent, each kmer goes to one candidate
+    std::vector <std::pair <uint32_t, uint64_t> > seeds;
+    for (auto it = frequent.begin(); it != frequent.end(); ++it) {
+        seeds.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(seeds.rbegin(), seeds.rend());
+
+    std::unordered_map <uint64_t, uint32_t> used; // kmers of written candidates
+    size_t candidates = 0;
+    for (auto seed = seeds.begin(); seed != seeds.end(); ++seed) {
+        if (!frequent.count(seed->second)) {
+            continue;
+        }
+        frequent.erase(seed->second);
+        used[seed->second] = seed->first;
+        if (low_complexity(seed->second) || branches_off(seed->second, seed->first, used)) {
+            continue;
+        }
+        std::string seq = decode_kmer(seed->second, DISCOVER_K);
+
+        // extend while a frequent kmer overlaps the end by K - 1 bases,
+        // taking the most frequent one if there are several
+        for (int right = 1; right >= 0; --right) {
+            uint64_t end = seed->second;
+            uint32_t end_count = seed->first;
+            while (true) {
+                auto best = frequent.end();
+                for (uint64_t base = 0; base < 4; ++base) {
+                    auto found = frequent.find(neighbour(end, base, right));
+                    if (found != frequent.end() && (best == frequent.end() || found->second > best->second)) {
+                        best = found;
+                    }
+                }
+                if (best == frequent.end() || best->second < end_count * DISCOVER_EXTEND_FRACTION) {
+                    break;
+                }
+                end = best->first;
+                end_count = best->second;
+                if (right) {
+                    seq += decode_kmer(end & 3, 1);
+                } else {
+                    seq.insert(0, decode_kmer(kmer_base(end, 0), 1));
+                }
+                used[end] = end_count;
+                frequent.erase(best);
+            }
+        }
+        out << seq << "\t-\t" << seed->first << '\n';
+        ++candidates;
+    }
+    return candidates;
+}
+
+std::string decode_kmer(uint64_t kmer, size_t k)
+{
+    static const char bases[] = "acgt";
+    std::string seq(k, 'n');
+    for (size_t i = 0; i < k; ++i) {
+        seq[k - 1 - i] = bases[kmer & 3];
+        kmer >>= 2;
+    }
+    return seq;
+}
@@ -0,0 +1,81 @@
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include <ostream>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+#define DISCOVER_K 20 // kmer length, at most 32
+#define DISCOVER_TAIL 50 // bases counted at the 3' end of every read
+#define DISCOVER_SKETCH_DEPTH 4 // counters per kmer
+#define DISCOVER_SKETCH_BITS 22 // log2 of counters in the sketch
+#define DISCOVER_BLOCK_BITS 4 // log2 of counters in a cache line
+#define DISCOVER_TOP 1000 // kmers tracked as heavy hitters
+#define DISCOVER_TOP_SLOTS 2048 // of their index, a power of two at least twice as large
+#define DISCOVER_MIN_FRACTION 0.001 // of counted reads, for a kmer to be reported
+#define DISCOVER_MIN_COUNT 10
+// a neighbour kmer with a smaller share of the count is a read flank or an error
+#define DISCOVER_EXTEND_FRACTION 0.5
+
+// Finds overrepresented kmers at read ends in fixed memory, to suggest
+// kmers for an unknown adapter. Counts go to a count-min sketch, and the
+// DISCOVER_TOP kmers with the largest estimates are kept as heavy hitters.
+// A rare kmer sharing counters with a frequent one inherits its estimate,
+// so heavy hitters are also counted exactly from the time they are kept,
+// and only these counts are reported. Overlapping heavy hitters are then
+// assembled into candidate sequences.
+//
+// The sketch is blocked: all counters of a kmer are in one cache line, so
+// counting a kmer costs one cache miss instead of one per counter. Heavy
+// hitters are a min-heap by estimate with an open addressing index by
+// kmer, both of fixed size, so counting does not touch the heap memory.
+class KmerDiscovery
+{
+public:
+    KmerDiscovery();
+
+    // Counts kmers without N's in the last DISCOVER_TAIL bases of a read
+    // encoded with encode_seq
+    void add(const unsigned char * codes, size_t size);
+
+    // Writes candidates in the kmers file format: sequence, "-" (no search
+    // window) and the count of its most frequent kmer, most frequent first.
+    // Returns the number of candidates.
+    size_t write(std::ostream & out) const;
+
+    size_t get_reads() const
+    {
+        return reads;
+    }
+
+private:
+    struct HeavyHitter
+    {
+        uint64_t kmer;
+        uint32_t estimate; // of the sketch, orders the heap
+        uint32_t count; // occurrences since the kmer was kept, at most its real count
+        size_t slot; // in the index
+    };
+
+    void update_top(uint64_t kmer, uint32_t estimate);
+    size_t find_slot(uint64_t kmer) const;
+    void erase_slot(size_t slot);
+    void place(size_t i, HeavyHitter const & hitter);
+    void sift_up(size_t i);
+    void sift_down(size_t i);
+
+    std::vector <uint32_t> sketch;
+    size_t sketch_begin; // first counter of the cache line aligned part
+    std::vector <HeavyHitter> top; // min-heap by estimate, at most DISCOVER_TOP
+    std::vector <uint32_t> top_index; // heap position + 1 by slot, 0 for empty slots
+    std::vector <uint64_t> kmers; // kmers of the current read
+    std::vector <size_t> blocks; // and their sketch blocks
+    size_t reads;
+};
+
+// Sequence of a kmer packed two bits per base
+std::string decode_kmer(uint64_t kmer, size_t k);
+
+#endif // DISCOVER_H
@@ -0,0 +1,68 @@
+#include "encode.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+unsigned char encode_base(char c)
+{
+    switch (c) {
+    case 'A':
+    case 'a':
+        return code_A;
+    case 'C':
+    case 'c':
+        return code_C;
+    case 'G':
+    case 'g':
+        return code_G;
+    case 'T':
+    case 't':
+        return code_T;
+    case 'N':
+    case 'n':
+        return code_N;
+    default:
+        return code_other;
+    }
+}
+
+void encode_seq(const char * seq, size_t len, unsigned char * codes)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    // 16 bases at a time: clear the lowercase bit, then select the code of
+    // every letter that matches
+    const __m128i upper_mask = _mm_set1_epi8((char)0xDF);
+    const __m128i letter_A = _mm_set1_epi8('A');
+    const __m128i letter_C = _mm_set1_epi8('C');
+    const __m128i letter_G = _mm_set1_epi8('G');
+    const __m128i letter_T = _mm_set1_epi8('T');
+    const __m128i letter_N = _mm_set1_epi8('N');
+    for (; i + 16 <= len; i += 16) {
+        __m128i upper = _mm_and_si128(_mm_loadu_si128((const __m128i *)(seq + i)), upper_mask);
+        __m128i res = _mm_set1_epi8(code_other);
+        __m128i is_A = _mm_cmpeq_epi8(upper, letter_A);
+        res = _mm_andnot_si128(is_A, res);
+        __m128i is_C = _mm_cmpeq_epi8(upper, letter_C);
+        res = _mm_or_si128(_mm_andnot_si128(is_C, res), _mm_and_si128(is_C, _mm_set1_epi8(code_C)));
+        __m128i is_G = _mm_cmpeq_epi8(upper, letter_G);
+        res = _mm_or_si128(_mm_andnot_si128(is_G, res), _mm_and_si128(is_G, _mm_set1_epi8(code_G)));
+        __m128i is_T = _mm_cmpeq_epi8(upper, letter_T);
+        res = _mm_or_si128(_mm_andnot_si128(is_T, res), _mm_and_si128(is_T, _mm_set1_epi8(code_T)));
+        __m128i is_N = _mm_cmpeq_epi8(upper, letter_N);
+        res = _mm_or_si128(_mm_andnot_si128(is_N, res), _mm_and_si128(is_N, _mm_set1_epi8(code_N)));
+        _mm_storeu_si128((__m128i *)(codes + i), res);
+    }
+#endif
+    for (; i < len; ++i) {
+        codes[i] = encode_base(seq[i]);
+    }
+}
+
+std::string encode_seq(std::string const & seq)
+{
+    std::string codes(seq.size(), 0);
+    encode_seq(seq.data(), seq.size(), (unsigned char *)&codes[0]);
+    return codes;
+}
@@ -0,0 +1,24 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <string>
+#include <cstddef>
+
+// Reads and patterns are matched as dense base codes, case insensitive
+enum BaseCode {
+    code_A = 0,
+    code_C,
+    code_G,
+    code_T,
+    code_N,
+    code_other
+};
+
+#define CODES_COUNT 6
+
+unsigned char encode_base(char c);
+// Writes the code of every base of seq to codes, which should hold len bytes
+void encode_seq(const char * seq, size_t len, unsigned char * codes);
+std::string encode_seq(std::string const & seq);
+
+#endif // ENCODE_H
@@ -0,0 +1,389 @@
+#include "filter.h"
+#include "scratch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <unordered_map>
+
+ReadFilter::ReadFilter(FilterConfig const & config)
+    : config(config)
+{
+    if (config.length) {
+        kernel = config.dust_cutoff ? select_kernel<true, true>() : select_kernel<true, false>();
+    } else {
+        kernel = config.dust_cutoff ? select_kernel<false, true>() : select_kernel<false, false>();
+    }
+    switch (config.errors) {
+    case 0:
+        searcher = &ReadFilter::search_read<0>;
+        break;
+    case 1:
+        searcher = &ReadFilter::search_read<1>;
+        break;
+    default:
+        searcher = &ReadFilter::search_read<2>;
+        break;
+    }
+}
+
+ReadFilter::~ReadFilter()
+{
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        delete it->root;
+    }
+}
+
+bool ReadFilter::compile(std::istream & kmers_f)
+{
+    if (config.errors < 0 || config.errors > 2) {
+        return false;
+    }
+
+    if (!build_patterns(kmers_f, patterns, windows, config.polyG, config.filterN, config.window) ||
+            patterns.empty()) {
+        return false;
+    }
+
+    // usually one or two windows, so a linear lookup is enough
+    for (size_t id = 0; id < patterns.size(); ++id) {
+        auto group = groups.begin();
+        while (group != groups.end() && !(group->window == windows[id])) {
+            ++group;
+        }
+        if (group == groups.end()) {
+            group = groups.insert(groups.end(), PatternGroup(windows[id]));
+        }
+        group->ids.push_back(id);
+        group->patterns.push_back(patterns[id]);
+        group->pattern_codes.push_back(encode_seq(patterns[id].first));
+    }
+
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        build_trie(*it->root, it->patterns, config.errors);
+        add_failures(*it->root);
+    }
+    return true;
+}
+
+// Picks the kernel once, so that the per-read path has no checks for
+// disabled filters and the error count is known at compile time.
+template <bool use_length, bool use_dust>
+ReadFilter::Kernel ReadFilter::select_kernel() const
+{
+    switch (config.errors) {
+    case 0:
+        return &ReadFilter::classify_reads<use_length, use_dust, 0>;
+    case 1:
+        return &ReadFilter::classify_reads<use_length, use_dust, 1>;
+    default:
+        return &ReadFilter::classify_reads<use_length, use_dust, 2>;
+    }
+}
+
+template <bool use_length, bool use_dust, int max_errors>
+void ReadFilter::classify_reads(SeqView const * reads, size_t count, ReadType * verdicts,
+                                FilterScratch & scratch, MatchStats * match_stats, Match * matches) const
+{
+    for (size_t i = 0; i < count; ++i) {
+        verdicts[i] = check_read<use_length, use_dust, max_errors>(reads[i], scratch, match_stats,
+                                                                   matches ? matches + i : NULL);
+    }
+}
+
+template <bool use_length, bool use_dust, int max_errors>
+ReadType ReadFilter::check_read(SeqView const & read, FilterScratch & scratch, MatchStats * match_stats,
+                                Match * match) const
+{
+    if (use_length && read.size < config.length) {
+        return ReadType::length;
+    }
+
+    // every later stage works on the encoded read
+    FilterScratch::State & state = *scratch.state;
+    if (state.codes.size() < read.size) {
+        state.codes.resize(read.size);
+    }
+    const unsigned char * codes = &state.codes[0];
+    encode_seq(read.data, read.size, &state.codes[0]);
+
+    if (use_dust && get_dust_score(codes, read.size, config.dust_k, state.dust) > config.dust_cutoff) {
+        return ReadType::dust;
+    }
+
+    if (!match_stats) {
+        return search_read<max_errors>(codes, read.size, scratch, match);
+    }
+    Match read_match;
+    ReadType type = search_read<max_errors>(codes, read.size, scratch, &read_match);
+    if (type != ReadType::ok) {
+        match_stats->update(read_match, patterns);
+        if (match) {
+            *match = read_match;
+        }
+    }
+    return type;
+}
+
+// Only the window of every group is scanned. Groups are searched in turn,
+// so with several windows the first group with a match decides the verdict.
+template <int max_errors>
+ReadType ReadFilter::search_read(const unsigned char * codes, size_t size, FilterScratch & scratch, Match * match) const
+{
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        size_t begin, window_size;
+        it->window.range(size, begin, window_size);
+        ReadType type = search_group(*it, codes + begin, window_size, scratch, match,
+                                     std::integral_constant<int, max_errors>());
+        if (type != ReadType::ok) {
+            if (match) {
+                match->pattern_id = it->ids[match->pattern_id];
+                match->end += begin;
+            }
+            return type;
+        }
+    }
+    return ReadType::ok;
+}
+
+ReadType ReadFilter::search_group(PatternGroup const & group, const unsigned char * codes, size_t size,
+                                  FilterScratch &, Match * match, std::integral_constant<int, 0>) const
+{
+    return (ReadType)search_any(codes, size, group.root, match);
+}
+
+template <int max_errors>
+ReadType ReadFilter::search_group(PatternGroup const & group, const unsigned char * codes, size_t size,
+                                  FilterScratch & scratch, Match * match, std::integral_constant<int, max_errors>) const
+{
+    return (ReadType)search_inexact<max_errors>(codes, size, group.root, group.pattern_codes, scratch.state->search, match);
+}
+
+FilterScratch::FilterScratch()
+    : state(new State())
+{
+}
+
+FilterScratch::~FilterScratch()
+{
+    delete state;
+}
+
+const unsigned char * FilterScratch::codes() const
+{
+    return &state->codes[0];
+}
+
+void ProfileScratch::reset(size_t filters_count)
+{
+    if (dust_scores.size() < filters_count) {
+        dust_scores.resize(filters_count);
+        verdicts.resize(filters_count);
+        matches.resize(filters_count);
+    }
+    dust_done.assign(filters_count, false);
+    search_done.assign(filters_count, false);
+}
+
+void ProfileSet::add(ReadFilter const * filter)
+{
+    size_t id = filters.size();
+    filters.push_back(filter);
+    search_source.push_back(id);
+    dust_source.push_back(id);
+    for (size_t i = id; i-- > 0; ) {
+        if (filters[i]->same_search(*filter)) {
+            search_source[id] = i;
+        }
+        if (filters[i]->get_config().dust_k == filter->get_config().dust_k) {
+            dust_source[id] = i;
+        }
+    }
+}
+
+void ProfileSet::classify(SeqView const & read, FilterScratch & scratch, ReadType * verdicts, Match * matches,
+                          MatchStats * const * match_stats) const
+{
+    if (filters.size() == 1) {
+        verdicts[0] = filters[0]->classify(read, scratch, match_stats ? match_stats[0] : NULL, matches);
+        return;
+    }
+
+    ProfileScratch & state = scratch.state->profiles;
+    state.reset(filters.size());
+    std::vector <unsigned char> & read_codes = scratch.state->codes;
+    if (read_codes.size() < read.size) {
+        read_codes.resize(read.size);
+    }
+    const unsigned char * codes = &read_codes[0];
+    encode_seq(read.data, read.size, &read_codes[0]);
+
+    for (size_t i = 0; i < filters.size(); ++i) {
+        FilterConfig const & config = filters[i]->get_config();
+        if (config.length && read.size < config.length) {
+            verdicts[i] = ReadType::length;
+            continue;
+        }
+        if (config.dust_cutoff) {
+            size_t source = dust_source[i];
+            if (!state.dust_done[source]) {
+                state.dust_scores[source] = get_dust_score(codes, read.size, config.dust_k, scratch.state->dust);
+                state.dust_done[source] = true;
+            }
+            if (state.dust_scores[source] > config.dust_cutoff) {
+                verdicts[i] = ReadType::dust;
+                continue;
+            }
+        }
+        size_t source = search_source[i];
+        if (!state.search_done[source]) {
+            state.verdicts[source] = filters[source]->search(codes, read.size, scratch, &state.matches[source]);
+            state.search_done[source] = true;
+        }
+        verdicts[i] = state.verdicts[source];
+        if (verdicts[i] != ReadType::ok) {
+            if (matches) {
+                matches[i] = state.matches[source];
+            }
+            if (match_stats && match_stats[i]) {
+                match_stats[i]->update(state.matches[source], filters[i]->get_patterns());
+            }
+        }
+    }
+}
+
+bool parse_window(std::string const & spec, SearchWindow & window)
+{
+    if (spec == "all") {
+        window = SearchWindow();
+        return true;
+    }
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos || colon + 1 == spec.size() ||
+            spec.find_first_not_of("0123456789", colon + 1) != std::string::npos) {
+        return false;
+    }
+    std::string end = spec.substr(0, colon);
+    size_t length = std::atol(spec.c_str() + colon + 1);
+    if (length == 0) {
+        return false;
+    }
+    if (end == "first") {
+        window = SearchWindow(SearchWindow::first, length);
+    } else if (end == "last") {
+        window = SearchWindow(SearchWindow::last, length);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string window_name(SearchWindow const & window)
+{
+    if (window.end == SearchWindow::all) {
+        return "all";
+    }
+    return (window.end == SearchWindow::first ? "first:" : "last:") + std::to_string(window.length);
+}
+
+// Second columns of older kmers files hold free text, which is ignored as
+// before. Only a column starting like a window has to be a valid one.
+static bool is_window_spec(std::string const & spec)
+{
+    return spec == "all" || spec.compare(0, 6, "first:") == 0 || spec.compare(0, 5, "last:") == 0;
+}
+
+bool build_patterns(std::istream & kmers_f, std::vector <std::pair <std::string, Node::Type> > & patterns,
+                    std::vector <SearchWindow> & windows, int polyG, bool filterN,
+                    SearchWindow const & default_window)
+{
+    std::string tmp;
+    while (!kmers_f.eof()) {
+        std::getline(kmers_f, tmp);
+        if (!tmp.empty() && tmp[tmp.size() - 1] == '\r') {
+            tmp.erase(tmp.size() - 1);
+        }
+        if (!tmp.empty()) {
+            size_t tab = tmp.find('\t');
+            std::string kmer = tmp.substr(0, tab);
+            std::transform(kmer.begin(), kmer.end(), kmer.begin(), ::toupper);
+            SearchWindow window = default_window;
+            if (tab != std::string::npos) {
+                // the window is the second column, anything after it is ignored
+                std::string spec = tmp.substr(tab + 1, tmp.find('\t', tab + 1) - tab - 1);
+                if (is_window_spec(spec) && !parse_window(spec, window)) {
+                    return false;
+                }
+            }
+            patterns.push_back(std::make_pair(kmer, Node::Type::adapter));
+            windows.push_back(window);
+        }
+    }
+
+    if (filterN) {
+        patterns.push_back(std::make_pair("N", Node::Type::n));
+        windows.push_back(SearchWindow());
+    }
+    if (polyG) {
+        patterns.push_back(std::make_pair(std::string(polyG, 'G'), Node::Type::polyG));
+        patterns.push_back(std::make_pair(std::string(polyG, 'C'), Node::Type::polyC));
+        windows.push_back(SearchWindow());
+        windows.push_back(SearchWindow());
+    }
+    return true;
+}
+
+void * DustArena::allocate(size_t bytes)
+{
+    size_t words = (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    if (used + words > buffer.size()) {
+        overflow.push_back(std::vector <uint64_t>(words));
+        overflow_words += words;
+        return &overflow.back()[0];
+    }
+    void * block = &buffer[used];
+    used += words;
+    return block;
+}
+
+void DustArena::reset()
+{
+    if (overflow_words) {
+        // with room to spare, so that a few longer reads later do not grow it again
+        buffer.resize(2 * (buffer.size() + overflow_words));
+        overflow.clear();
+        overflow_words = 0;
+    }
+    used = 0;
+}
+
+typedef std::unordered_map <int, int, std::hash<int>, std::equal_to<int>,
+                            DustAllocator<std::pair<const int, int> > > DustCounts;
+
+double get_dust_score(const unsigned char * codes, size_t read_len, int k, DustScratch & scratch)
+{
+    // kmers are keyed in base 10 (N 1, A 2, C 3, G 4, T 5, other 0) in a new
+    // map for every read: the score below adds up counts in the iteration
+    // order of the map, so the keys and the map decide the verdicts. Only
+    // its memory is reused.
+    static const unsigned int digits[CODES_COUNT] = {2, 3, 4, 5, 1, 0};
+    scratch.arena.reset();
+    DustCounts counts(DustCounts::allocator_type(scratch.arena));
+    unsigned int hash = 0;
+    // wraps like the kmer keys for k above 10
+    unsigned int max_pow = (unsigned int)(uint64_t)pow(10, k - 1);
+    for (const unsigned char * it = codes; it != codes + read_len; ++it) {
+        hash = hash * 10 + digits[*it];
+        if (it - codes >= k - 1) {
+            ++counts[hash];
+            hash = hash - (hash / max_pow) * max_pow;
+        }
+    }
+    double score = 0;
+    double total = 0;
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        score += it->second * (it->second - 1) / 2;
+        total += score;
+    }
+    return (total / (read_len - k + 1));
+}
@@ -0,0 +1,254 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <istream>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <type_traits>
+
+#include "search.h"
+#include "stats.h"
+#include "seq.h"
+
+#define LENGTH_CUTOFF 50
+#define DUST_K 4
+#define POLYG 13
+#define DUST_K_MAX 20 // 10^(k - 1) fits in 64 bits
+
+// Part of a read searched for a pattern: the whole read, its first or its
+// last length bases
+struct SearchWindow {
+    enum End {
+        all,
+        first,
+        last
+    };
+
+    SearchWindow() : end(all), length(0) {}
+    SearchWindow(End end, size_t length) : end(end), length(length) {}
+
+    // Bounds of the window in a read of read_len bases, [begin, begin + size)
+    void range(size_t read_len, size_t & begin, size_t & size) const
+    {
+        size = (end == all || length > read_len) ? read_len : length;
+        begin = (end == last) ? read_len - size : 0;
+    }
+
+    bool operator == (SearchWindow const & other) const
+    {
+        return end == other.end && length == other.length;
+    }
+
+    End end;
+    size_t length;
+};
+
+// Parses "first:N", "last:N" or "all"
+bool parse_window(std::string const & spec, SearchWindow & window);
+std::string window_name(SearchWindow const & window);
+
+struct FilterConfig {
+    FilterConfig()
+        : length(LENGTH_CUTOFF), polyG(POLYG), dust_k(DUST_K), dust_cutoff(0),
+          errors(0), filterN(false) {}
+
+    size_t length;
+    int polyG;
+    int dust_k;
+    int dust_cutoff;
+    int errors;
+    bool filterN;
+    SearchWindow window; // for kmers without a window in the kmers file
+};
+
+// Read sequence owned by the caller, the filter never copies it
+struct SeqView {
+    SeqView() : data(NULL), size(0) {}
+    SeqView(const char * data, size_t size) : data(data), size(size) {}
+    SeqView(std::string const & seq) : data(seq.data()), size(seq.size()) {}
+
+    const char * data;
+    size_t size;
+};
+
+// Working state for one thread calling ReadFilter::classify. Buffers grow to
+// the largest read seen and are reused, so steady state filtering does not
+// touch the heap. Its contents are private to the library.
+class FilterScratch
+{
+public:
+    FilterScratch();
+    ~FilterScratch();
+
+    // The read last given to classify, encoded with encode_seq, unless it
+    // was filtered by length before being encoded
+    const unsigned char * codes() const;
+
+private:
+    struct State; // defined in scratch.h
+
+    FilterScratch(FilterScratch const &);
+    FilterScratch & operator = (FilterScratch const &);
+
+    State * state;
+
+    friend class ReadFilter;
+    friend class ProfileSet;
+};
+
+// Compiled kmers automaton together with the filter options. Build it once
+// with compile(), then classify reads from any number of threads, each with
+// its own FilterScratch.
+class ReadFilter
+{
+public:
+    ReadFilter(FilterConfig const & config);
+    ~ReadFilter();
+
+    // Reads kmers (one per line, optionally followed by a tab and a search
+    // window) and builds an automaton for every distinct window. Returns
+    // false if the config or a window is invalid or there are no patterns.
+    bool compile(std::istream & kmers_f);
+
+    // Writes a verdict for each of count reads, ReadType::ok for reads to keep.
+    // Match statistics are collected only if match_stats is not NULL. If
+    // matches is not NULL, it receives the matched pattern of every read
+    // filtered by a pattern (adapter, N, polyG or polyC).
+    void classify(SeqView const * reads, size_t count, ReadType * verdicts,
+                  FilterScratch & scratch, MatchStats * match_stats = NULL, Match * matches = NULL) const
+    {
+        (this->*kernel)(reads, count, verdicts, scratch, match_stats, matches);
+    }
+
+    void classify(SeqView const * reads, size_t count, ReadType * verdicts,
+                  MatchStats * match_stats = NULL, Match * matches = NULL) const
+    {
+        FilterScratch scratch;
+        (this->*kernel)(reads, count, verdicts, scratch, match_stats, matches);
+    }
+
+    ReadType classify(SeqView const & read, FilterScratch & scratch, MatchStats * match_stats = NULL,
+                      Match * match = NULL) const
+    {
+        ReadType verdict;
+        (this->*kernel)(&read, 1, &verdict, scratch, match_stats, match);
+        return verdict;
+    }
+
+    // Searches the patterns only, in a read encoded with encode_seq
+    ReadType search(const unsigned char * codes, size_t size, FilterScratch & scratch, Match * match = NULL) const
+    {
+        return (this->*searcher)(codes, size, scratch, match);
+    }
+
+    // True if search gives the same results for both filters
+    bool same_search(ReadFilter const & other) const
+    {
+        return config.errors == other.config.errors && patterns == other.patterns && windows == other.windows;
+    }
+
+    FilterConfig const & get_config() const
+    {
+        return config;
+    }
+
+    std::vector <std::pair<std::string, Node::Type> > const & get_patterns() const
+    {
+        return patterns;
+    }
+
+    std::vector <SearchWindow> const & get_windows() const
+    {
+        return windows;
+    }
+
+private:
+    // Patterns sharing a search window, with their own automaton
+    struct PatternGroup {
+        PatternGroup(SearchWindow const & window) : window(window), root(new Node('0')) {}
+
+        SearchWindow window;
+        Node * root;
+        std::vector <size_t> ids; // pattern ids in the filter by ids in the group
+        std::vector <std::pair<std::string, Node::Type> > patterns;
+        std::vector <std::string> pattern_codes;
+    };
+
+    typedef void (ReadFilter::*Kernel)(SeqView const * reads, size_t count, ReadType * verdicts,
+                                       FilterScratch & scratch, MatchStats * match_stats,
+                                       Match * matches) const;
+    typedef ReadType (ReadFilter::*Searcher)(const unsigned char * codes, size_t size,
+                                             FilterScratch & scratch, Match * match) const;
+
+    ReadFilter(ReadFilter const &);
+    ReadFilter & operator = (ReadFilter const &);
+
+    template <bool use_length, bool use_dust>
+    Kernel select_kernel() const;
+
+    template <bool use_length, bool use_dust, int max_errors>
+    void classify_reads(SeqView const * reads, size_t count, ReadType * verdicts,
+                        FilterScratch & scratch, MatchStats * match_stats, Match * matches) const;
+
+    template <bool use_length, bool use_dust, int max_errors>
+    ReadType check_read(SeqView const & read, FilterScratch & scratch, MatchStats * match_stats,
+                        Match * match) const;
+
+    template <int max_errors>
+    ReadType search_read(const unsigned char * codes, size_t size, FilterScratch & scratch, Match * match) const;
+
+    ReadType search_group(PatternGroup const & group, const unsigned char * codes, size_t size,
+                          FilterScratch & scratch, Match * match, std::integral_constant<int, 0>) const;
+
+    template <int max_errors>
+    ReadType search_group(PatternGroup const & group, const unsigned char * codes, size_t size,
+                          FilterScratch & scratch, Match * match, std::integral_constant<int, max_errors>) const;
+
+    FilterConfig config;
+    std::vector <std::pair<std::string, Node::Type> > patterns;
+    std::vector <SearchWindow> windows; // by pattern id
+    std::vector <PatternGroup> groups; // in order of the first pattern of each window
+    Kernel kernel;
+    Searcher searcher;
+};
+
+// Several filters applied to the same reads in one pass, e.g. a strict and
+// a lenient one. A read is encoded once, its DUST score is computed once for
+// every kmer size, and filters with the same patterns, windows and error
+// count share one search.
+class ProfileSet
+{
+public:
+    // Filters are not owned, they should outlive the set
+    void add(ReadFilter const * filter);
+
+    size_t size() const
+    {
+        return filters.size();
+    }
+
+    ReadFilter const & get_filter(size_t i) const
+    {
+        return *filters[i];
+    }
+
+    // Writes a verdict and a match for every filter, in order of add(). If
+    // match_stats is not NULL, it holds a MatchStats pointer (or NULL) for every filter.
+    void classify(SeqView const & read, FilterScratch & scratch, ReadType * verdicts, Match * matches,
+                  MatchStats * const * match_stats = NULL) const;
+
+private:
+    std::vector <ReadFilter const *> filters;
+    std::vector <size_t> search_source; // by filter: the first filter with the same search
+    std::vector <size_t> dust_source; // by filter: the first filter with the same dust_k
+};
+
+// Returns false if a kmer has an invalid window. Kmers with "-", any other
+// text that is not a window or no second column get default_window, N and
+// polyG/polyC patterns are searched in the whole read. Lines may end with CRLF.
+bool build_patterns(std::istream & kmers_f, std::vector <std::pair <std::string, Node::Type> > & patterns,
+                    std::vector <SearchWindow> & windows, int polyG, bool filterN,
+                    SearchWindow const & default_window = SearchWindow());
+
+#endif // FILTER_H
@@ -0,0 +1,161 @@
+#include "rejects.h"
+
+#include <cstring>
+#include <sstream>
+
+bool RejectOutput::open(TypeNames const & names)
+{
+    switch (format) {
+    case fastq:
+        out.open((prefix + ".filtered.fastq").c_str(), std::ofstream::out);
+        break;
+    case none:
+        return true;
+    case tsv:
+        out.open((prefix + ".rejected.tsv").c_str(), std::ofstream::out);
+        out << "#read\treason\tname\tpattern\tposition" << std::endl;
+        break;
+    case binary:
+        out.open((prefix + ".rejected.bin").c_str(), std::ofstream::out | std::ofstream::binary);
+        uint32_t version = REJECT_LOG_VERSION;
+        uint32_t names_count = READ_TYPES_COUNT;
+        out.write(REJECT_LOG_MAGIC, 4);
+        out.write((const char *)&version, sizeof(version));
+        out.write((const char *)&names_count, sizeof(names_count));
+        for (int type = 0; type < READ_TYPES_COUNT; ++type) {
+            TypeNames::const_iterator name = names.find((ReadType)type);
+            uint32_t length = (name != names.end()) ? name->second.size() : 0;
+            out.write((const char *)&length, sizeof(length));
+            if (length) {
+                out.write(name->second.data(), length);
+            }
+        }
+        break;
+    }
+    return out.good();
+}
+
+void RejectOutput::close()
+{
+    if (out.is_open()) {
+        out.close();
+    }
+}
+
+void RejectOutput::write_record(size_t index, ReadType type, Match const & match,
+                                std::vector <std::pair<std::string, Node::Type> > const & patterns)
+{
+    bool matched = (type != ReadType::length && type != ReadType::dust);
+    uint32_t pattern = matched ? match.pattern_id : REJECT_NO_POSITION;
+    uint32_t position = matched ? match_start(match, patterns) : REJECT_NO_POSITION;
+    if (format == tsv) {
+        out << index << '\t' << (int)type << '\t' << get_type_name(type) << '\t';
+        if (matched) {
+            out << pattern << '\t' << position << '\n';
+        } else {
+            out << "-\t-\n";
+        }
+    } else {
+        uint64_t read_index = index;
+        uint32_t reason = type;
+        out.write((const char *)&read_index, sizeof(read_index));
+        out.write((const char *)&reason, sizeof(reason));
+        out.write((const char *)&pattern, sizeof(pattern));
+        out.write((const char *)&position, sizeof(position));
+    }
+}
+
+bool parse_reject_format(std::string const & value, RejectOutput::Format & format)
+{
+    if (value == "fastq") {
+        format = RejectOutput::fastq;
+    } else if (value == "none") {
+        format = RejectOutput::none;
+    } else if (value == "tsv") {
+        format = RejectOutput::tsv;
+    } else if (value == "bin") {
+        format = RejectOutput::binary;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Name is only read from the tsv log, the binary one has names in its header
+static bool read_reject(std::ifstream & log_f, bool binary, uint64_t & index, uint32_t & reason, std::string & name)
+{
+    if (binary) {
+        uint32_t pattern, position;
+        log_f.read((char *)&index, sizeof(index));
+        log_f.read((char *)&reason, sizeof(reason));
+        log_f.read((char *)&pattern, sizeof(pattern));
+        log_f.read((char *)&position, sizeof(position));
+        return log_f.good();
+    }
+    std::string line;
+    while (std::getline(log_f, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        return (bool)(fields >> index >> reason >> name);
+    }
+    return false;
+}
+
+static bool read_names(std::ifstream & log_f, std::vector <std::string> & names)
+{
+    uint32_t names_count = 0;
+    log_f.read((char *)&names_count, sizeof(names_count));
+    if (!log_f || names_count != READ_TYPES_COUNT) {
+        return false;
+    }
+    names.resize(names_count);
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        uint32_t length = 0;
+        log_f.read((char *)&length, sizeof(length));
+        if (!log_f || length > REJECT_NAME_MAX) {
+            return false;
+        }
+        it->resize(length);
+        if (length) {
+            log_f.read(&(*it)[0], length);
+        }
+    }
+    return log_f.good();
+}
+
+bool rebuild_filtered(std::ifstream & reads_f, std::ifstream & log_f, std::ofstream & out)
+{
+    char magic[4];
+    std::vector <std::string> names;
+    bool binary = log_f.read(magic, 4) && std::memcmp(magic, REJECT_LOG_MAGIC, 4) == 0;
+    if (binary) {
+        uint32_t version = 0;
+        log_f.read((char *)&version, sizeof(version));
+        if (version != REJECT_LOG_VERSION || !read_names(log_f, names)) {
+            return false;
+        }
+    } else {
+        log_f.clear();
+        log_f.seekg(0);
+    }
+
+    Seq read;
+    uint64_t read_index = 0;
+    uint64_t index;
+    uint32_t reason;
+    std::string name;
+    while (read_reject(log_f, binary, index, reason, name)) {
+        if (index < read_index || reason == ReadType::ok || reason >= READ_TYPES_COUNT) {
+            return false;
+        }
+        do {
+            if (!read.read_seq(reads_f)) {
+                return false;
+            }
+        } while (read_index++ < index);
+        read.write_seq(out, binary ? names[reason] : name);
+    }
+    return out.good();
+}
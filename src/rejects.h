@@ -0,0 +1,76 @@
+#ifndef REJECTS_H
+#define REJECTS_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "search.h"
+#include "seq.h"
+
+#define REJECT_LOG_MAGIC "RMRJ"
+#define REJECT_LOG_VERSION 2
+#define REJECT_NAME_MAX 256
+#define REJECT_NO_POSITION 0xFFFFFFFF
+
+// Destination of filtered reads: full records with the reason in the id
+// (default), nothing, or a compact log which can be turned back into
+// records with rebuild_filtered.
+//
+// The binary log starts with REJECT_LOG_MAGIC and the uint32 version, then
+// the uint32 number of reasons and the name of each one (uint32 length and
+// the characters), followed by 20 byte records in native byte order:
+// uint64 read index, uint32 reason (ReadType), uint32 pattern id and uint32
+// start position of the match. Pattern and position are REJECT_NO_POSITION
+// for reads filtered by length or dust. Both logs keep the reason names,
+// e.g. length50, so reads are rebuilt without the original options.
+class RejectOutput
+{
+public:
+    enum Format {
+        fastq,
+        none,
+        tsv,
+        binary
+    };
+
+    RejectOutput(std::string const & prefix, Format format) : prefix(prefix), format(format) {}
+
+    // The binary log stores names, the reason names of the run
+    bool open(TypeNames const & names);
+    void close();
+
+    void write(Seq & read, size_t index, ReadType type, Match const & match,
+               std::vector <std::pair<std::string, Node::Type> > const & patterns)
+    {
+        switch (format) {
+        case fastq:
+            read.write_seq(out, type);
+            break;
+        case none:
+            break;
+        default:
+            write_record(index, type, match, patterns);
+            break;
+        }
+    }
+
+private:
+    void write_record(size_t index, ReadType type, Match const & match,
+                      std::vector <std::pair<std::string, Node::Type> > const & patterns);
+
+    std::string prefix;
+    Format format;
+    std::ofstream out;
+};
+
+bool parse_reject_format(std::string const & value, RejectOutput::Format & format);
+
+// Writes reads listed in a reject log (either format) with the reason name
+// stored in the log in their ids, as they would have been written to
+// input_prefix.filtered.fastq
+bool rebuild_filtered(std::ifstream & reads_f, std::ifstream & log_f, std::ofstream & out);
+
+#endif // REJECTS_H
@@ -2,194 +2,228 @@
 #include <fstream>
 #include <vector>
 #include <string>
-#include <list>
-#include <map>
-#include <algorithm>
-#include <locale>
+#include <sstream>
+#include <memory>
 #include <getopt.h>
 #include <stdlib.h>
-#include <unordered_map>
 
-#include "search.h"
+#include "filter.h"
 #include "stats.h"
 #include "seq.h"
+#include "shards.h"
+#include "rejects.h"
+#include "discover.h"
 #include "rm_reads.h"
+#include "serve.h"
+#ifdef ALLOC_CHECK
+#include "alloc_check.h"
+#endif
+
+// Outputs and statistics of one filter profile. Without --profile there is
+// a single profile with an empty name, which keeps the usual file names.
+struct ProfileOutput {
+    ProfileOutput(FilterOptions const & options, FilterProfile const & profile, size_t patterns_count)
+        : prefix1(output_prefix(options, options.reads.empty() ? options.reads1 : options.reads, profile.name)),
+          prefix2(output_prefix(options, options.reads2, profile.name)),
+          ok1(prefix1 + ".ok", options.shard_reads, options.shard_bytes),
+          ok2(prefix2 + ".ok", options.shard_reads, options.shard_bytes),
+          bad1(prefix1, options.filtered_format),
+          bad2(prefix2, options.filtered_format),
+          stats1(stats_name(options.reads.empty() ? options.reads1 : options.reads, profile.name)),
+          stats2(stats_name(options.reads2, profile.name)),
+          match_stats1(options.match_stats ? patterns_count : 0),
+          match_stats2(options.match_stats && !options.reads2.empty() ? patterns_count : 0),
+          type_names(make_type_names(profile.config.length, profile.config.polyG,
+                                     profile.config.dust_k, profile.config.dust_cutoff)) {}
+
+    ProfileOutput(ProfileOutput const &) = delete;
+    ProfileOutput & operator = (ProfileOutput const &) = delete;
+
+    bool open(bool paired)
+    {
+        if (!ok1.open() || !bad1.open(type_names)) {
+            return false;
+        }
+        if (!paired) {
+            return true;
+        }
+        se1.open((prefix1 + ".se.fastq").c_str(), std::ofstream::out);
+        se2.open((prefix2 + ".se.fastq").c_str(), std::ofstream::out);
+        return ok2.open() && bad2.open(type_names) && se1.good() && se2.good();
+    }
 
-#define LENGTH_CUTOFF 50
-#define DUST_K 4
-#define POLYG 13
+    static std::string output_prefix(FilterOptions const & options, std::string const & reads, std::string const & name)
+    {
+        std::string prefix = options.out_dir + "/" + basename(reads);
+        return name.empty() ? prefix : prefix + "." + name;
+    }
+
+    static std::string stats_name(std::string const & reads, std::string const & name)
+    {
+        return name.empty() ? reads : reads + " [" + name + "]";
+    }
+
+    std::string prefix1;
+    std::string prefix2;
+    ShardedOutput ok1;
+    ShardedOutput ok2;
+    RejectOutput bad1;
+    RejectOutput bad2;
+    std::ofstream se1;
+    std::ofstream se2;
+    Stats stats1;
+    Stats stats2;
+    MatchStats match_stats1;
+    MatchStats match_stats2;
+    TypeNames type_names;
+};
 
 struct FilterCmd {
     FilterCmd()
-        : reads1_fp(nullptr), reads2_fp(nullptr),
-          ok1_fp(nullptr), ok2_fp(nullptr), bad1_fp(nullptr), bad2_fp(nullptr),
-          se1_fp(nullptr), se2_fp(nullptr),
-          stats1(), stats2(), root(nullptr),
-          length(LENGTH_CUTOFF), dust_k(DUST_K), dust_cutoff(0),
-          errors(0) {}
-
-private:
+        : reads1_fp(nullptr), reads2_fp(nullptr), discovery1(nullptr), discovery2(nullptr), filters(nullptr),
+          truncated_input(false) {}
 
-    ReadType check_read(std::string const & read, std::vector <std::pair<std::string, Node::Type> > const & patterns)
+    ~FilterCmd()
     {
-        if (length && read.size() < length) {
-            return ReadType::length;
-        }
-        if (dust_cutoff && get_dust_score(read, dust_k) > dust_cutoff) {
-            return ReadType::dust;
-        }
-
-        if (errors) {
-            return (ReadType)search_inexact(read, root, patterns, errors);
-        } else {
-            return (ReadType)search_any(read, root);
+        for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+            delete *it;
         }
     }
 
-    void filter_single_reads(std::vector <std::pair<std::string, Node::Type> > const & patterns)
+    FilterCmd(FilterCmd const &) = delete;
+    FilterCmd & operator = (FilterCmd const &) = delete;
+
+private:
+
+    bool filter_single_reads()
     {
         Seq read;
+        size_t index = 0;
 
         std::ifstream & reads_f = *reads1_fp;
-        std::ofstream & ok_f = *ok1_fp;
-        std::ofstream & bad_f = *bad1_fp;
-
-        while (read.read_seq(reads_f)) {
-            ReadType type = check_read(read.get_seq(), patterns);
-            stats1.update(type);
-            if (type == ReadType::ok) {
-                read.write_seq(ok_f);
-            } else {
-                read.update_id(type);
-                read.write_seq(bad_f);
+        MatchStats * const * match_stats = match_stats1.empty() ? NULL : &match_stats1[0];
+
+        for (; read.read_seq(reads_f); ++index) {
+            filters->classify(read.get_seq(), scratch, &verdicts1[0], &matches1[0], match_stats);
+            if (discovery1 && verdicts1[0] == ReadType::ok) {
+                discovery1->add(scratch.codes(), read.get_seq().size());
+            }
+            for (size_t i = 0; i < outputs.size(); ++i) {
+                ProfileOutput & output = *outputs[i];
+                ReadType type = verdicts1[i];
+                output.stats1.update(type);
+                if (type == ReadType::ok) {
+                    if (output.ok1.full(read) && !output.ok1.next_shard()) {
+                        return false;
+                    }
+                    output.ok1.write(read);
+                } else {
+                    use_type_names(output.type_names);
+                    output.bad1.write(read, index, type, matches1[i], filters->get_filter(i).get_patterns());
+                }
             }
+#ifdef ALLOC_CHECK
+            alloc_check.update();
+#endif
         }
+        truncated_input = read.is_truncated();
+        return true;
     }
 
-    void filter_paired_reads(std::vector <std::pair<std::string, Node::Type> > const & patterns)
+    bool filter_paired_reads()
     {
         Seq read1;
         Seq read2;
+        size_t index = 0;
 
         std::ifstream & reads1_f = *reads1_fp;
         std::ifstream & reads2_f = *reads2_fp;
-        std::ofstream & ok1_f = *ok1_fp;
-        std::ofstream & ok2_f = *ok2_fp;
-        std::ofstream & se1_f = *se1_fp;
-        std::ofstream & se2_f = *se2_fp;
-        std::ofstream & bad1_f = *bad1_fp;
-        std::ofstream & bad2_f = *bad2_fp;
-
-        while (read1.read_seq(reads1_f) && read2.read_seq(reads2_f)) {
-            ReadType type1 = check_read(read1.get_seq(), patterns);
-            ReadType type2 = check_read(read2.get_seq(), patterns);
-            if (type1 == ReadType::ok && type2 == ReadType::ok) {
-                read1.write_seq(ok1_f);
-                read2.write_seq(ok2_f);
-                stats1.update(type1, true);
-                stats2.update(type2, true);
-            } else {
-                stats1.update(type1, false);
-                stats2.update(type2, false);
+        MatchStats * const * match_stats1_p = match_stats1.empty() ? NULL : &match_stats1[0];
+        MatchStats * const * match_stats2_p = match_stats2.empty() ? NULL : &match_stats2[0];
+
+        for (; read1.read_seq(reads1_f) && read2.read_seq(reads2_f); ++index) {
+            // the scratch holds the codes of the last classified read, so
+            // each read is counted before its mate is classified
+            filters->classify(read1.get_seq(), scratch, &verdicts1[0], &matches1[0], match_stats1_p);
+            if (discovery1 && verdicts1[0] == ReadType::ok) {
+                discovery1->add(scratch.codes(), read1.get_seq().size());
+            }
+            filters->classify(read2.get_seq(), scratch, &verdicts2[0], &matches2[0], match_stats2_p);
+            if (discovery2 && verdicts2[0] == ReadType::ok) {
+                discovery2->add(scratch.codes(), read2.get_seq().size());
+            }
+            for (size_t i = 0; i < outputs.size(); ++i) {
+                ProfileOutput & output = *outputs[i];
+                std::vector <std::pair<std::string, Node::Type> > const & patterns = filters->get_filter(i).get_patterns();
+                ReadType type1 = verdicts1[i];
+                ReadType type2 = verdicts2[i];
+                if (type1 == ReadType::ok && type2 == ReadType::ok) {
+                    // mates always go to shards with the same number
+                    if ((output.ok1.full(read1) || output.ok2.full(read2)) &&
+                            (!output.ok1.next_shard() || !output.ok2.next_shard())) {
+                        return false;
+                    }
+                    output.ok1.write(read1);
+                    output.ok2.write(read2);
+                    output.stats1.update(type1, true);
+                    output.stats2.update(type2, true);
+                    continue;
+                }
+                output.stats1.update(type1, false);
+                output.stats2.update(type2, false);
+                use_type_names(output.type_names);
                 if (type1 == ReadType::ok) {
-                    read1.write_seq(se1_f);
-                    read2.update_id(type2);
-                    read2.write_seq(bad2_f);
+                    read1.write_seq(output.se1);
+                    output.bad2.write(read2, index, type2, matches2[i], patterns);
                 } else if (type2 == ReadType::ok) {
-                    read1.update_id(type1);
-                    read1.write_seq(bad1_f);
-                    read2.write_seq(se2_f);
+                    output.bad1.write(read1, index, type1, matches1[i], patterns);
+                    read2.write_seq(output.se2);
                 } else {
-                    read1.update_id(type1);
-                    read2.update_id(type2);
-                    read1.write_seq(bad1_f);
-                    read2.write_seq(bad2_f);
+                    output.bad1.write(read1, index, type1, matches1[i], patterns);
+                    output.bad2.write(read2, index, type2, matches2[i], patterns);
                 }
             }
+#ifdef ALLOC_CHECK
+            alloc_check.update();
+#endif
         }
+        truncated_input = read1.is_truncated() || read2.is_truncated();
+        return true;
     }
 
 public:
 
-    void filter_reads(std::vector <std::pair<std::string, Node::Type> > const & patterns) {
+    bool filter_reads() {
+        verdicts1.resize(outputs.size());
+        verdicts2.resize(outputs.size());
+        matches1.resize(outputs.size());
+        matches2.resize(outputs.size());
         if (reads2_fp == nullptr) {
-            filter_single_reads(patterns);
+            return filter_single_reads();
         } else {
-            filter_paired_reads(patterns);
+            return filter_paired_reads();
         }
     }
 
     std::ifstream * reads1_fp;
     std::ifstream * reads2_fp;
-    std::ofstream * ok1_fp;
-    std::ofstream * ok2_fp;
-    std::ofstream * bad1_fp;
-    std::ofstream * bad2_fp;
-    std::ofstream * se1_fp;
-    std::ofstream * se2_fp;
-    Stats stats1;
-    Stats stats2;
-    Node * root;
-    size_t length;
-    int dust_k;
-    int dust_cutoff;
-    int errors;
+    std::vector <ProfileOutput *> outputs; // owned, one for each filter
+    std::vector <MatchStats *> match_stats1; // empty without --match_stats
+    std::vector <MatchStats *> match_stats2;
+    KmerDiscovery * discovery1; // NULL without --discover
+    KmerDiscovery * discovery2;
+    ProfileSet const * filters;
+    FilterScratch scratch;
+    std::vector <ReadType> verdicts1;
+    std::vector <ReadType> verdicts2;
+    std::vector <Match> matches1;
+    std::vector <Match> matches2;
+    bool truncated_input; // reading stopped at a record cut short
+#ifdef ALLOC_CHECK
+    AllocCheck alloc_check;
+#endif
 };
 
-void build_patterns(std::ifstream & kmers_f, std::vector <std::pair <std::string, Node::Type> > & patterns, int polyG, bool filterN)
-{
-    std::string tmp;
-    while (!kmers_f.eof()) {
-        std::getline(kmers_f, tmp);
-        std::transform(tmp.begin(), tmp.end(), tmp.begin(), ::toupper);
-        if (!tmp.empty()) {
-            size_t tab = tmp.find('\t');
-            if (tab == std::string::npos) {
-                patterns.push_back(std::make_pair(tmp, Node::Type::adapter));
-            } else {
-                patterns.push_back(std::make_pair(tmp.substr(0, tab), Node::Type::adapter));
-            }
-        }
-    }
-    kmers_f.close();
-
-    if (filterN) {
-        patterns.push_back(std::make_pair("N", Node::Type::n));
-    }
-    if (polyG) {
-        patterns.push_back(std::make_pair(std::string(polyG, 'G'), Node::Type::polyG));
-        patterns.push_back(std::make_pair(std::string(polyG, 'C'), Node::Type::polyC));
-    }
-}
-
-double get_dust_score(std::string const & read, int k)
-{
-    std::unordered_map <int, int> counts;
-    static std::unordered_map <char, int> hashes = {{'N', 1},
-                                          {'A', 2},
-                                          {'C', 3},
-                                          {'G', 4},
-                                          {'T', 5}};
-    unsigned int hash = 0;
-    unsigned int max_pow = pow(10, k - 1);
-    for (auto it = read.begin(); it != read.end(); ++it) {
-        char c = std::toupper(*it);
-        hash = hash * 10 + hashes[c];
-        if (it - read.begin() >= k - 1) {
-            ++counts[hash];
-            hash = hash - (hash / max_pow) * max_pow;
-        }
-    }
-    double score = 0;
-    double total = 0;
-    for (auto it = counts.begin(); it != counts.end(); ++it) {
-        score += it->second * (it->second - 1) / 2;
-        total += score;
-    }
-//    std::cout << (total / (read.size() - k + 1)) << std::endl;
-    return (total / (read.size() - k + 1));
-}
-
 std::string basename(std::string const & path)
 {
     std::string res(path);
@@ -204,34 +238,64 @@ std::string basename(std::string const & path)
     return res;
 }
 
-void print_help() 
+static void resolve_path(std::string & path, std::string const & workdir)
 {
-    std::cerr << "Usage:\n./rm_reads <-i raw_data.fastq | -1 raw_data1.fastq -2 raw_data2.fastq> --adapters adapters.dat [-o output_dir --polyG POLYG --length LENGTH_CUTOFF --dust_cutoff cutoff --dust_k k -errors 0 -filterN]\n"
-        << "\nOptions:\n"
-        << "\t-i\t\tinput file \n"
-        << "\t-1\t\tfirst input file for paired reads\n"
-        << "\t-2\t\tsecond input file for paired reads\n"
-        << "\t-o\t\toutput directory (current directory by default)\n"
-        << "\t--polyG, -p\tlength of polyG/polyC tails (13 by default)\n"
-        << "\t--length, -l\tminimum length cutoff (50 by default)\n"
-        << "\t--adapters, -a\tfile with adapter kmers\n"
-        << "\t--dust_k, -k\twindow size for dust filter (not used by default)\n"
-        << "\t--dust_cutoff, -c\tcutoff by dust score (not used by default)\n"
-        << "\t--errors, -e\tmaximum error count in match, possible values - 0, 1, 2 (by default 0)\n"
-        << "\t--filterN, -N\tallow filter by N's in reads" << std::endl;
+    if (!path.empty() && path[0] != '/') {
+        path = workdir + "/" + path;
+    }
 }
 
-int main(int argc, char ** argv)
+// Parses name:option=value,... where options are long filter options
+// without dashes. Options not given are taken from base.
+static bool parse_profile(std::string const & spec, FilterConfig const & base, FilterProfile & profile)
 {
-    Node root('0');
-    std::vector <std::pair<std::string, Node::Type> > patterns;
+    size_t colon = spec.find(':');
+    profile.name = spec.substr(0, colon);
+    profile.config = base;
+    if (profile.name.empty() || profile.name.find('/') != std::string::npos) {
+        return false;
+    }
+    if (colon == std::string::npos) {
+        return true;
+    }
+
+    FilterConfig & config = profile.config;
+    std::istringstream options_stream(spec.substr(colon + 1));
+    std::string option;
+    while (std::getline(options_stream, option, ',')) {
+        size_t eq = option.find('=');
+        std::string key = option.substr(0, eq);
+        std::string value = (eq == std::string::npos) ? "" : option.substr(eq + 1);
+        if (key == "filterN") {
+            config.filterN = (value != "0");
+        } else if (value.empty()) {
+            return false;
+        } else if (key == "length") {
+            config.length = std::atoi(value.c_str());
+        } else if (key == "polyG") {
+            config.polyG = std::atoi(value.c_str());
+        } else if (key == "dust_k") {
+            config.dust_k = std::atoi(value.c_str());
+        } else if (key == "dust_cutoff") {
+            config.dust_cutoff = std::atoi(value.c_str());
+        } else if (key == "errors") {
+            config.errors = std::atoi(value.c_str());
+        } else if (key == "window") {
+            if (!parse_window(value, config.window)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
 
-    std::string kmers, reads, out_dir;
-    std::string reads1, reads2;
+int parse_options(int argc, char ** argv, FilterOptions & options, std::ostream & err)
+{
     char rez = 0;
-    int polyG = POLYG;
-    bool filterN = false;
-    FilterCmd cmd;
+    FilterConfig & config = options.config;
+    std::vector <std::string> profile_specs;
 
     const struct option long_options[] = {
         {"help", no_argument, NULL, 'h'},
@@ -242,172 +306,366 @@ int main(int argc, char ** argv)
         {"dust_cutoff",required_argument,NULL,'c'},
         {"errors", required_argument, NULL, 'e'},
         {"filterN", no_argument, NULL, 'N'},
+        {"match_stats", no_argument, NULL, 'm'},
+        {"split_output", required_argument, NULL, 's'},
+        {"filtered", required_argument, NULL, 'f'},
+        {"rebuild_filtered", required_argument, NULL, 'r'},
+        {"window", required_argument, NULL, 'W'},
+        {"profile", required_argument, NULL, 'P'},
+        {"discover", no_argument, NULL, 'D'},
+        {"workdir", required_argument, NULL, 'w'},
         {NULL,0,NULL,0}
     };
 
-    while ((rez = getopt_long(argc, argv, "hN1:2:l:p:a:i:o:e:", long_options, NULL)) != -1) {
+    optind = 0;
+    while ((rez = getopt_long(argc, argv, "hNmD1:2:l:p:a:i:o:e:s:f:r:k:c:W:P:", long_options, NULL)) != -1) {
         switch (rez) {
         case 'l':
-            cmd.length = std::atoi(optarg);
+            config.length = std::atoi(optarg);
             break;
         case 'p':
-            polyG = std::atoi(optarg);
+            config.polyG = std::atoi(optarg);
             // polyG = boost::lexical_cast<int>(optarg);
             break;
         case 'a':
-            kmers = optarg;
+            options.kmers = optarg;
             break;
         case 'i':
-            reads = optarg;
+            options.reads = optarg;
             break;
         case '1':
-            reads1 = optarg;
+            options.reads1 = optarg;
             break;
         case '2':
-            reads2 = optarg;
+            options.reads2 = optarg;
             break;
         case 'o':
-            out_dir = optarg;
+            options.out_dir = optarg;
             break;
         case 'c':
-            cmd.dust_cutoff = std::atoi(optarg);
+            config.dust_cutoff = std::atoi(optarg);
             break;
         case 'k':
-            cmd.dust_k = std::atoi(optarg);
+            config.dust_k = std::atoi(optarg);
             break;
         case 'e':
-            cmd.errors = std::atoi(optarg);
+            config.errors = std::atoi(optarg);
             break;
         case 'N':
-            filterN = true;
+            config.filterN = true;
+            break;
+        case 'm':
+            options.match_stats = true;
+            break;
+        case 's':
+            if (!parse_shard_size(optarg, options.shard_reads, options.shard_bytes)) {
+                err << "Shard size should be a reads count or a size with K, M or G suffix" << std::endl;
+                return -1;
+            }
+            break;
+        case 'f':
+            if (!parse_reject_format(optarg, options.filtered_format)) {
+                err << "Possible filtered output formats are fastq, none, tsv, bin" << std::endl;
+                return -1;
+            }
+            break;
+        case 'r':
+            options.rejects = optarg;
+            break;
+        case 'W':
+            if (!parse_window(optarg, config.window)) {
+                err << "Search window should be first:N, last:N or all" << std::endl;
+                return -1;
+            }
+            break;
+        case 'D':
+            options.discover = true;
+            break;
+        case 'P':
+            profile_specs.push_back(optarg);
+            break;
+        case 'w':
+            options.workdir = optarg;
             break;
         case '?':
         case 'h':
-            print_help();
+            print_help(err);
             return -1;
         }
     }
 
-    if (cmd.errors < 0 || cmd.errors > 2) {
-        std::cerr << "Possible errors count are 0, 1, 2" << std::endl;
+    if (config.errors < 0 || config.errors > 2) {
+        err << "Possible errors count are 0, 1, 2" << std::endl;
         return -1;
     }
 
-    if (out_dir.empty()) {
-        out_dir = ".";
+    if (config.dust_k < 1 || config.dust_k > DUST_K_MAX) {
+        err << "DUST window size should be from 1 to " << DUST_K_MAX << std::endl;
+        return -1;
     }
 
-    if (kmers.empty() || (reads.empty() &&
-            (reads1.empty() || reads2.empty()))) {
-        std::cerr << "Please, specify reads and kmers files" << std::endl;
-        print_help();
+    for (auto it = profile_specs.begin(); it != profile_specs.end(); ++it) {
+        FilterProfile profile;
+        if (!parse_profile(*it, config, profile)) {
+            err << "Profile should be name:option=value,... with options length, polyG, dust_k, dust_cutoff, errors, filterN, window" << std::endl;
+            return -1;
+        }
+        if (profile.config.errors < 0 || profile.config.errors > 2) {
+            err << "Possible errors count are 0, 1, 2" << std::endl;
+            return -1;
+        }
+        if (profile.config.dust_k < 1 || profile.config.dust_k > DUST_K_MAX) {
+            err << "DUST window size should be from 1 to " << DUST_K_MAX << std::endl;
+            return -1;
+        }
+        for (auto other = options.profiles.begin(); other != options.profiles.end(); ++other) {
+            if (other->name == profile.name) {
+                err << "Profile " << profile.name << " is given twice" << std::endl;
+                return -1;
+            }
+        }
+        options.profiles.push_back(profile);
+    }
+    if (options.profiles.empty()) {
+        FilterProfile profile;
+        profile.config = config;
+        options.profiles.push_back(profile);
+    }
+
+    if (options.out_dir.empty()) {
+        options.out_dir = ".";
+    }
+
+    if (!options.workdir.empty()) {
+        resolve_path(options.kmers, options.workdir);
+        resolve_path(options.reads, options.workdir);
+        resolve_path(options.reads1, options.workdir);
+        resolve_path(options.reads2, options.workdir);
+        resolve_path(options.out_dir, options.workdir);
+        resolve_path(options.rejects, options.workdir);
+    }
+
+    if (!options.rejects.empty()) {
+        return 0;
+    }
+
+    if (options.kmers.empty() || (options.reads.empty() &&
+            (options.reads1.empty() || options.reads2.empty()))) {
+        err << "Please, specify reads and kmers files" << std::endl;
+        print_help(err);
         return -1;
     }
+    return 0;
+}
 
+ReadFilter * compile_filter(std::string const & kmers, FilterConfig const & config, std::ostream & err)
+{
     std::ifstream kmers_f (kmers.c_str());
     if (!kmers_f.good()) {
-        std::cerr << "Cannot open kmers file" << std::endl;
-        print_help();
-        return -1;
+        err << "Cannot open kmers file" << std::endl;
+        print_help(err);
+        return NULL;
     }
 
-    init_type_names(length, polyG, cmd.dust_k, cmd.dust_cutoff);
-
-    build_patterns(kmers_f, patterns, polyG, filterN);
+    // freed if compile throws, e.g. bad_alloc in a server
+    std::unique_ptr <ReadFilter> filter(new ReadFilter(config));
+    if (!filter->compile(kmers_f)) {
+        err << "patterns are empty or have invalid search windows" << std::endl;
+        return NULL;
+    }
+    return filter.release();
+}
 
-    if (patterns.empty()) {
-        std::cerr << "patterns are empty" << std::endl;
+int run_filter(FilterOptions const & options, ProfileSet const & filters, std::ostream & out, std::ostream & err)
+{
+    bool paired = options.reads.empty();
+    std::ifstream reads1_f((paired ? options.reads1 : options.reads).c_str());
+    std::ifstream reads2_f;
+    if (paired) {
+        reads2_f.open(options.reads2.c_str());
+    }
+    if (!reads1_f.good() || (paired && !reads2_f.good())) {
+        err << "Cannot open reads file, please, make sure that it exists" << std::endl;
+        print_help(err);
         return -1;
     }
 
-    build_trie(root, patterns, cmd.errors);
-	add_failures(root);
+    FilterCmd cmd;
+    cmd.filters = &filters;
+    cmd.reads1_fp = &reads1_f;
+    cmd.reads2_fp = paired ? &reads2_f : nullptr;
+    for (size_t i = 0; i < filters.size(); ++i) {
+        ProfileOutput * output = new ProfileOutput(options, options.profiles[i],
+                                                   filters.get_filter(i).get_patterns().size());
+        cmd.outputs.push_back(output);
+        if (!output->open(paired)) {
+            err << "Cannot open output files, please, make sure that output directory exists and you can write there" << std::endl;
+            print_help(err);
+            return -1;
+        }
+        if (options.match_stats) {
+            cmd.match_stats1.push_back(&output->match_stats1);
+            cmd.match_stats2.push_back(&output->match_stats2);
+        }
+    }
 
-    cmd.root = &root;
+    // the sketches take some memory, so they are only made for --discover
+    std::unique_ptr <KmerDiscovery> discovery1;
+    std::unique_ptr <KmerDiscovery> discovery2;
+    if (options.discover) {
+        discovery1.reset(new KmerDiscovery());
+        cmd.discovery1 = discovery1.get();
+        if (paired) {
+            discovery2.reset(new KmerDiscovery());
+            cmd.discovery2 = discovery2.get();
+        }
+    }
 
-    if (!reads.empty()) {
-        std::string reads_base = basename(reads);
-        std::ifstream reads_f (reads.c_str());
-        std::ofstream ok_f((out_dir + "/" + reads_base + ".ok.fastq").c_str(), std::ofstream::out);
-        std::ofstream bad_f((out_dir + "/" + reads_base + ".filtered.fastq").c_str(), std::ofstream::out);
+    if (!cmd.filter_reads()) {
+        err << "Cannot open output shard" << std::endl;
+        return -1;
+    }
+    if (cmd.truncated_input) {
+        err << "Reads file ends with an incomplete record" << std::endl;
+        return -1;
+    }
 
-        if (!reads_f.good()) {
-            std::cerr << "Cannot open reads file, please, make sure that it exists" << std::endl;
-            print_help();
-            return -1;
+    if (options.discover) {
+        std::ofstream discovered1_f((options.out_dir + "/" + basename(paired ? options.reads1 : options.reads) + ".discovered.dat").c_str(), std::ofstream::out);
+        discovery1->write(discovered1_f);
+        if (paired) {
+            std::ofstream discovered2_f((options.out_dir + "/" + basename(options.reads2) + ".discovered.dat").c_str(), std::ofstream::out);
+            discovery2->write(discovered2_f);
         }
+    }
 
-        if (!ok_f.good() || !bad_f.good()) {
-            std::cerr << "Cannot open output files, please, make sure that output directory exists and you can write there" << std::endl;
-            print_help();
-            return -1;
+    for (size_t i = 0; i < cmd.outputs.size(); ++i) {
+        ProfileOutput & output = *cmd.outputs[i];
+        std::vector <std::pair<std::string, Node::Type> > const & patterns = filters.get_filter(i).get_patterns();
+        output.ok1.close();
+        output.ok2.close();
+        output.bad1.close();
+        output.bad2.close();
+
+        use_type_names(output.type_names);
+        out << output.stats1;
+        if (paired) {
+            out << output.stats2;
         }
 
-        cmd.stats1 = Stats(reads);
-        cmd.reads1_fp = &reads_f;
-        cmd.ok1_fp = &ok_f;
-        cmd.bad1_fp = &bad_f;
-
-        cmd.filter_reads(patterns);
-
-        std::cout << cmd.stats1;
-
-        ok_f.close();
-        bad_f.close();
-        reads_f.close();
-    } else {
-        std::string reads1_base = basename(reads1);
-        std::string reads2_base = basename(reads2);
-        std::ifstream reads1_f(reads1.c_str());
-        std::ifstream reads2_f(reads2.c_str());
-        std::ofstream ok1_f((out_dir + "/" + reads1_base + ".ok.fastq").c_str(),
-                            std::ofstream::out);
-        std::ofstream ok2_f((out_dir + "/" + reads2_base + ".ok.fastq").c_str(),
-                            std::ofstream::out);
-        std::ofstream se1_f((out_dir + "/" + reads1_base + ".se.fastq").c_str(),
-                            std::ofstream::out);
-        std::ofstream se2_f((out_dir + "/" + reads2_base + ".se.fastq").c_str(),
-                            std::ofstream::out);
-        std::ofstream bad1_f((out_dir + "/" + reads1_base + ".filtered.fastq").c_str(),
-                            std::ofstream::out);
-        std::ofstream bad2_f((out_dir + "/" + reads2_base + ".filtered.fastq").c_str(),
-                            std::ofstream::out);
-
-        if (!reads1_f.good() || !reads2_f.good()) {
-            std::cerr << "Cannot open reads file, please, make sure that it exists" << std::endl;
-            print_help();
-            return -1;
+        if (output.ok1.split()) {
+            output.ok1.write_manifest(output.prefix1 + ".ok.manifest.tsv");
+            if (paired) {
+                output.ok2.write_manifest(output.prefix2 + ".ok.manifest.tsv");
+            }
         }
 
-        if (!ok1_f.good() || !ok2_f.good() || !bad1_f.good() || !bad2_f.good() ||
-                !se1_f.good() || !se2_f.good()) {
-            std::cerr << "Cannot open output files, please, make sure that output directory exists and you can write there" << std::endl;
-            print_help();
-            return -1;
+        if (options.match_stats) {
+            std::ofstream match1_f((output.prefix1 + ".matches.tsv").c_str(), std::ofstream::out);
+            output.match_stats1.write_tsv(match1_f, patterns);
+            if (paired) {
+                std::ofstream match2_f((output.prefix2 + ".matches.tsv").c_str(), std::ofstream::out);
+                output.match_stats2.write_tsv(match2_f, patterns);
+            }
         }
+    }
+#ifdef ALLOC_CHECK
+    if (!cmd.alloc_check.report(err)) {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int rebuild_filtered(FilterOptions const & options, std::ostream & err)
+{
+    if (options.reads.empty()) {
+        err << "Please, specify reads file the reject log was written for with -i" << std::endl;
+        return -1;
+    }
 
-        cmd.stats1 = Stats(reads1);
-        cmd.stats2 = Stats(reads2);
-        cmd.reads1_fp = &reads1_f;
-        cmd.reads2_fp = &reads2_f;
-        cmd.ok1_fp = &ok1_f;
-        cmd.ok2_fp = &ok2_f;
-        cmd.se1_fp = &se1_f;
-        cmd.se2_fp = &se2_f;
-        cmd.bad1_fp = &bad1_f;
-        cmd.bad2_fp = &bad2_f;
-
-        cmd.filter_reads(patterns);
-
-        std::cout << cmd.stats1;
-        std::cout << cmd.stats2;
-
-        ok1_f.close();
-        ok2_f.close();
-        bad1_f.close();
-        bad2_f.close();
-        reads1_f.close();
-        reads2_f.close();
+    std::ifstream reads_f(options.reads.c_str());
+    std::ifstream rejects_f(options.rejects.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (!reads_f.good() || !rejects_f.good()) {
+        err << "Cannot open reads file or reject log, please, make sure that they exist" << std::endl;
+        return -1;
+    }
+    std::ofstream bad_f((options.out_dir + "/" + basename(options.reads) + ".filtered.fastq").c_str(), std::ofstream::out);
+    if (!bad_f.good()) {
+        err << "Cannot open output files, please, make sure that output directory exists and you can write there" << std::endl;
+        return -1;
+    }
+
+    if (!rebuild_filtered(reads_f, rejects_f, bad_f)) {
+        err << "Reject log does not match reads file" << std::endl;
+        return -1;
     }
     return 0;
 }
+
+void print_help(std::ostream & out)
+{
+    out << "Usage:\n./rm_reads <-i raw_data.fastq | -1 raw_data1.fastq -2 raw_data2.fastq> --adapters adapters.dat [-o output_dir --polyG POLYG --length LENGTH_CUTOFF --dust_cutoff cutoff --dust_k k -errors 0 -filterN -match_stats --split_output N --filtered fastq --window last:40]\n"
+        << "./rm_reads serve --socket rm_reads.sock [--threads N]\n"
+        << "./rm_reads submit rm_reads.sock <filter options>\n"
+        << "\nOptions:\n"
+        << "\t-i\t\tinput file \n"
+        << "\t-1\t\tfirst input file for paired reads\n"
+        << "\t-2\t\tsecond input file for paired reads\n"
+        << "\t-o\t\toutput directory (current directory by default)\n"
+        << "\t--polyG, -p\tlength of polyG/polyC tails (13 by default)\n"
+        << "\t--length, -l\tminimum length cutoff (50 by default)\n"
+        << "\t--adapters, -a\tfile with adapter kmers\n"
+        << "\t--dust_k, -k\twindow size for dust filter, from 1 to 20 (4 by default)\n"
+        << "\t--dust_cutoff, -c\tcutoff by dust score (not used by default)\n"
+        << "\t--errors, -e\tmaximum error count in match, possible values - 0, 1, 2 (by default 0)\n"
+        << "\t--filterN, -N\tallow filter by N's in reads\n"
+        << "\t--match_stats, -m\twrite per-pattern hit counts and match positions to input_prefix.matches.tsv\n"
+        << "\t--split_output, -s\tsplit correct reads into shards of given reads count or size with K, M or G suffix\n"
+        << "\t--filtered, -f\toutput for filtered reads: fastq (by default), none, tsv or bin reject log\n"
+        << "\t--window, -W\tsearch kmers without a window in the kmers file only in first:N or last:N bases of reads (all by default)\n"
+        << "\t--profile, -P\tname:option=value,... filter with these options instead, writing input_prefix.name.* outputs; can be given several times, options not given are taken from the command line, which is not run as a filter of its own (e.g. strict:errors=2,length=75,dust_cutoff=2)\n"
+        << "\t--discover, -D\twrite overrepresented sequences at 3' ends of kept reads to input_prefix.discovered.dat, in kmers file format\n"
+        << "\t--rebuild_filtered, -r\twrite input_prefix.filtered.fastq for reads file given with -i from its reject log\n"
+        << "\nServe options:\n"
+        << "\t--socket, -S\tUnix socket to accept filter jobs on\n"
+        << "\t--threads, -t\tnumber of jobs run in parallel (number of cores by default)" << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "serve") {
+        return serve(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "submit") {
+        return submit(argc - 1, argv + 1);
+    }
+
+    FilterOptions options;
+    if (parse_options(argc, argv, options, std::cerr)) {
+        return -1;
+    }
+
+    if (!options.rejects.empty()) {
+        return rebuild_filtered(options, std::cerr);
+    }
+
+    ProfileSet filters;
+    std::vector <ReadFilter *> compiled;
+    for (auto it = options.profiles.begin(); it != options.profiles.end(); ++it) {
+        ReadFilter * filter = compile_filter(options.kmers, it->config, std::cerr);
+        if (!filter) {
+            break;
+        }
+        compiled.push_back(filter);
+        filters.add(filter);
+    }
+    int res = -1;
+    if (compiled.size() == options.profiles.size()) {
+        res = run_filter(options, filters, std::cout, std::cerr);
+    }
+    for (auto it = compiled.begin(); it != compiled.end(); ++it) {
+        delete *it;
+    }
+    return res;
+}
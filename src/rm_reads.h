@@ -1,9 +1,51 @@
 #ifndef RM_READS_H
 #define RM_READS_H
 
-void build_patterns(std::ifstream & kmers_f, std::vector <std::pair <std::string, Node::Type> > & patterns, int polyG, bool filterN);
-double get_dust_score(std::string const & read, int k);
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "filter.h"
+#include "rejects.h"
+
+// Named filter options, each profile gets its own outputs from the same
+// pass over the reads
+struct FilterProfile {
+    std::string name; // empty for the only profile of a run without --profile
+    FilterConfig config; // options of this profile
+};
+
+// Options of one filter run, given on the command line or in a serve job
+struct FilterOptions {
+    FilterOptions()
+        : match_stats(false), discover(false), shard_reads(0), shard_bytes(0),
+          filtered_format(RejectOutput::fastq) {}
+
+    std::string kmers;
+    std::string reads;
+    std::string reads1;
+    std::string reads2;
+    std::string out_dir;
+    std::string rejects;
+    std::string workdir; // base for relative paths, the current directory if empty
+    bool match_stats;
+    bool discover;
+    size_t shard_reads;
+    size_t shard_bytes;
+    RejectOutput::Format filtered_format;
+    FilterConfig config; // base options of every profile
+    std::vector <FilterProfile> profiles; // at least one after parse_options
+};
+
 std::string basename(std::string const & path);
-void print_help();
+// Parses filter options, returns 0 on success
+int parse_options(int argc, char ** argv, FilterOptions & options, std::ostream & err);
+// Returns NULL and reports to err if the kmers file cannot be used
+ReadFilter * compile_filter(std::string const & kmers, FilterConfig const & config, std::ostream & err);
+// Filters input files with a filter for each of options.profiles, reads
+// statistics are written to out. Returns 0 on success
+int run_filter(FilterOptions const & options, ProfileSet const & filters, std::ostream & out, std::ostream & err);
+int rebuild_filtered(FilterOptions const & options, std::ostream & err);
+void print_help(std::ostream & out);
 
 #endif // RM_READS_H
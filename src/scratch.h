@@ -0,0 +1,90 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+// Internal to the library: what a FilterScratch holds
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "filter.h"
+#include "search.h"
+#include "seq.h"
+
+// Memory for the kmer counts of one read in get_dust_score. Blocks are
+// handed out in order and all released by reset(), which also grows the
+// buffer past what the last read needed, so once the longest read has been
+// seen counting does not touch the heap.
+class DustArena {
+public:
+    DustArena() : used(0), overflow_words(0) {}
+
+    void * allocate(size_t bytes);
+    void reset();
+
+private:
+    std::vector <uint64_t> buffer;
+    size_t used; // words of buffer handed out
+    std::vector <std::vector <uint64_t> > overflow; // blocks that did not fit, until reset
+    size_t overflow_words;
+};
+
+// Allocator of the kmer counts map, deallocation waits for DustArena::reset
+template <class T>
+struct DustAllocator {
+    typedef T value_type;
+
+    DustAllocator(DustArena & arena) : arena(&arena) {}
+    template <class U>
+    DustAllocator(DustAllocator<U> const & other) : arena(other.arena) {}
+
+    T * allocate(size_t n)
+    {
+        return static_cast<T *>(arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    DustArena * arena;
+};
+
+template <class T, class U>
+bool operator == (DustAllocator<T> const & a, DustAllocator<U> const & b)
+{
+    return a.arena == b.arena;
+}
+
+template <class T, class U>
+bool operator != (DustAllocator<T> const & a, DustAllocator<U> const & b)
+{
+    return a.arena != b.arena;
+}
+
+// Per-read working state of the DUST filter, reused between reads
+struct DustScratch {
+    DustArena arena;
+};
+
+// Per-read state of ProfileSet::classify, by filter
+struct ProfileScratch {
+    void reset(size_t filters_count);
+
+    std::vector <double> dust_scores;
+    std::vector <ReadType> verdicts; // search results
+    std::vector <Match> matches;
+    std::vector <bool> dust_done;
+    std::vector <bool> search_done;
+};
+
+struct FilterScratch::State {
+    State() : codes(SEQ_RESERVE) {}
+
+    std::vector <unsigned char> codes; // encoded read
+    SearchScratch search;
+    DustScratch dust;
+    ProfileScratch profiles;
+};
+
+double get_dust_score(const unsigned char * codes, size_t read_len, int k, DustScratch & scratch);
+
+#endif // SCRATCH_H
@@ -1,12 +1,34 @@
 #include "search.h"
 
 #include <list>
-#include <map>
 #include <fstream>
 #include <algorithm>
 
 unsigned int last_id = 1;
 
+void SearchScratch::reset(size_t patterns_count)
+{
+    if (matches.size() < patterns_count) {
+        // reserve upfront, so that the first partial match of every pattern
+        // does not hit the heap later on
+        matches.resize(patterns_count);
+        for (auto it = matches.begin(); it != matches.end(); ++it) {
+            it->reserve(SCRATCH_MATCHES_RESERVE);
+        }
+        matched_patterns.reserve(patterns_count);
+    }
+    for (auto it = matched_patterns.begin(); it != matched_patterns.end(); ++it) {
+        matches[*it].clear();
+    }
+    matched_patterns.clear();
+}
+
+size_t match_start(Match const & match, std::vector <std::pair<std::string, Node::Type> > const & patterns)
+{
+    size_t pattern_size = patterns[match.pattern_id].first.size();
+    return (match.end + 1 > pattern_size) ? match.end + 1 - pattern_size : 0;
+}
+
 void build_trie(Node & root, std::vector <std::pair <std::string, Node::Type> > const & patterns, int errors)
 {
     for (auto it = patterns.begin(); it != patterns.end(); ++it) {
@@ -14,16 +36,19 @@ void build_trie(Node & root, std::vector <std::pair <std::string, Node::Type> >
         const std::string & pattern = it->first;
         size_t pattern_size = pattern.size();
         for (size_t j = 0; j < pattern_size; ++j) {
-            Node * next = curr_node->next(pattern[j]);
+            unsigned char code = encode_base(pattern[j]);
+            Node * next = curr_node->next(code);
             if (next == NULL) {
-                Node * new_node = new Node(pattern[j]);
+                Node * new_node = new Node(code);
                 curr_node->links.push_back(new_node);
+                curr_node->children[code] = new_node;
                 curr_node = new_node;
             } else {
                 curr_node = next;
             }
             if (j == pattern_size - 1) {
                 curr_node->type = it->second;
+                curr_node->pattern_id = (size_t)(it - patterns.begin());
             }
             if (it->second == Node::Type::adapter && errors != 0) {
                 if (errors == 1) {
@@ -59,6 +84,14 @@ void add_failures(Node & root)
     do {
         Node * curr = queue.front();
         queue.pop_front();
+        // fail is shallower than curr, so its transitions are already known
+        for (unsigned char c = 0; c < CODES_COUNT; ++c) {
+            if (curr->children[c]) {
+                curr->delta[c] = curr->children[c];
+            } else {
+                curr->delta[c] = (curr == &root) ? &root : curr->fail->delta[c];
+            }
+        }
         for (std::vector <Node *>::iterator it = curr->links.begin(); it != curr->links.end(); ++it) {
             if (curr != &root) {
                 Node * parent = curr;
@@ -75,41 +108,40 @@ void add_failures(Node & root)
     } while(queue.size());
 }
 
-void go(Node * & curr, char c)
-{
-    while (!curr->next(c) && curr != curr->fail) {
-        curr = curr->fail;
-    }
-    Node * next = curr->next(c);
-    if (next) {
-        curr = next;
-    }
-}
-
+template <int errors>
 Node::Type find_all_matches(Node * node, size_t pos,
-                      std::map <size_t, std::vector <std::pair<size_t, size_t> > > & matches,
-                      size_t errors) {
+                      SearchScratch & scratch,
+                      Match * match) {
     Node * curr = node;
     while (curr->fail != curr) {
         if (curr->type) {
             if (curr->type != Node::Type::adapter) {
+                if (match) {
+                    match->pattern_id = curr->pattern_id;
+                    match->end = pos;
+                }
                 return curr->type;
             }
             for (auto it = curr->adapter_id_pos.begin(); it != curr->adapter_id_pos.end(); ++it) {
-                std::vector <std::pair<size_t, size_t> > & curr_matches = matches[it->first];
+                std::vector <std::pair<size_t, size_t> > & curr_matches = scratch.matches[it->first];
+                if (curr_matches.empty()) {
+                    scratch.matched_patterns.push_back(it->first);
+                }
                 curr_matches.push_back(std::make_pair(pos, it->second));
-                if (curr_matches.size() >= errors + 1){
+                if (curr_matches.size() >= (size_t)errors + 1){
                     size_t begin_pos = pos - it->second;
                     size_t pattern_size = it->second + 1;
-                    if (errors == 1 &&
-                        std::binary_search(curr_matches.begin(), curr_matches.end(), std::pair <size_t, size_t> (begin_pos + pattern_size / 2, pattern_size / 2))) {
-                        return curr->type;
-                    }
-                    if (errors == 2 &&
-                        std::binary_search(curr_matches.begin(), curr_matches.end(),
-                                           std::pair <size_t, size_t> (begin_pos + pattern_size / 3, pattern_size / 3)) &&
-                        std::binary_search(curr_matches.begin(), curr_matches.end(),
-                                           std::pair <size_t, size_t> (begin_pos + pattern_size * 2 / 3, pattern_size * 2 / 3))) {
+                    if ((errors == 1 &&
+                         std::binary_search(curr_matches.begin(), curr_matches.end(), std::pair <size_t, size_t> (begin_pos + pattern_size / 2, pattern_size / 2))) ||
+                        (errors == 2 &&
+                         std::binary_search(curr_matches.begin(), curr_matches.end(),
+                                            std::pair <size_t, size_t> (begin_pos + pattern_size / 3, pattern_size / 3)) &&
+                         std::binary_search(curr_matches.begin(), curr_matches.end(),
+                                            std::pair <size_t, size_t> (begin_pos + pattern_size * 2 / 3, pattern_size * 2 / 3)))) {
+                        if (match) {
+                            match->pattern_id = it->first;
+                            match->end = pos;
+                        }
                         return curr->type;
                     }
                 }
@@ -120,10 +152,14 @@ Node::Type find_all_matches(Node * node, size_t pos,
     return Node::Type::no_match;
 }
 
-Node::Type find_match(Node * node) {
+Node::Type find_match(Node * node, size_t pos, Match * match) {
     Node * curr = node;
     while (curr->fail != curr) {
         if (curr->type) {
+            if (match) {
+                match->pattern_id = curr->pattern_id;
+                match->end = pos;
+            }
             return curr->type;
         }
         curr = curr->fail;
@@ -131,24 +167,20 @@ Node::Type find_match(Node * node) {
     return Node::Type::no_match;
 }
 
-bool cmp_upper(char i, char j)
-{
-    return std::toupper(i) == std::toupper(j);
-}
-
-int count_errors(std::string const & text, int text_pos,
+template <int err_max>
+int count_errors(const unsigned char * text, size_t text_len, int text_pos,
                  std::string const & pattern, size_t pattern_pos,
-                 size_t length, int err_max)
+                 size_t length)
 {
-    if (text_pos < 0) {
+    if (text_pos < 0 || text_pos + length > text_len) {
         return err_max + 1;
     }
-    auto text_it = text.begin() + text_pos;
+    auto text_it = text + text_pos;
     auto text_last = text_it + length;
     auto pattern_it = pattern.begin() + pattern_pos;
     int errors = 0;
     while (errors <= err_max) {
-        auto mismatch = std::mismatch(text_it, text_last, pattern_it, cmp_upper);
+        auto mismatch = std::mismatch(text_it, text_last, pattern_it);
         if (mismatch.first == text_last) {
             return errors;
         }
@@ -159,76 +191,81 @@ int count_errors(std::string const & text, int text_pos,
     return errors;
 }
 
-bool check_partial_matches(std::string const & text,
-                           std::vector <std::pair<std::string, Node::Type> > const & patterns,
-                           std::map <size_t, std::vector <std::pair <size_t, size_t> > > & matches, int errors)
+template <int errors>
+bool check_partial_matches(const unsigned char * text, size_t text_len,
+                           std::vector <std::string> const & pattern_codes,
+                           SearchScratch & scratch,
+                           Match * match)
 {
-    for (auto it = matches.begin(); it != matches.end(); ++it) {
-        size_t pattern_size = patterns[it->first].first.size();
-        while (!it->second.empty()) {
-            auto start_match = it->second.begin();
+    std::sort(scratch.matched_patterns.begin(), scratch.matched_patterns.end());
+    for (auto it = scratch.matched_patterns.begin(); it != scratch.matched_patterns.end(); ++it) {
+        size_t pattern_id = *it;
+        std::vector <std::pair <size_t, size_t> > & pattern_matches = scratch.matches[pattern_id];
+        size_t pattern_size = pattern_codes[pattern_id].size();
+        while (!pattern_matches.empty()) {
+            auto start_match = pattern_matches.begin();
             int res_errors = 0;
             size_t begin_pos = start_match->first;
             if (errors == 1) {
                 if (start_match->second == pattern_size - 1) {
                     begin_pos -= pattern_size - 1;
-                    res_errors = count_errors(text, begin_pos,
-                                              patterns[it->first].first, 0, pattern_size/2, 1);
+                    res_errors = count_errors<1>(text, text_len, begin_pos,
+                                              pattern_codes[pattern_id], 0, pattern_size/2);
                 } else {
                     begin_pos -= pattern_size/2;
-                    res_errors = count_errors(text, start_match->first,
-                                              patterns[it->first].first, start_match->second, pattern_size - start_match->second, 1);
+                    res_errors = count_errors<1>(text, text_len, start_match->first,
+                                              pattern_codes[pattern_id], start_match->second, pattern_size - start_match->second);
                 }
             } else {
                 if (start_match->second == pattern_size - 1) {
                     begin_pos -= pattern_size - 1;
-                    res_errors = count_errors(text, begin_pos,
-                                              patterns[it->first].first, 0, pattern_size / 3, 1);
+                    res_errors = count_errors<1>(text, text_len, begin_pos,
+                                              pattern_codes[pattern_id], 0, pattern_size / 3);
                     if (res_errors < 2) {
-                        res_errors += count_errors(text, begin_pos + pattern_size / 3,
-                                                  patterns[it->first].first, pattern_size / 3, pattern_size * 2/3 - pattern_size / 3, 1);
+                        res_errors += count_errors<1>(text, text_len, begin_pos + pattern_size / 3,
+                                                  pattern_codes[pattern_id], pattern_size / 3, pattern_size * 2/3 - pattern_size / 3);
                     } else {
                         ++res_errors;
                     }
                 } else if (start_match->second == pattern_size * 2/3) {
                     begin_pos -= pattern_size * 2/3;
-                    auto found = std::lower_bound(it->second.begin(), it->second.end(),
+                    auto found = std::lower_bound(pattern_matches.begin(), pattern_matches.end(),
                                                   std::pair <size_t, size_t> (begin_pos + pattern_size - 1, pattern_size - 1));
-                    if (*found == std::pair <size_t, size_t> (begin_pos + pattern_size - 1, pattern_size - 1)){
-                        res_errors = count_errors(text, begin_pos,
-                                                  patterns[it->first].first, 0, pattern_size / 3, 2);
-                        it->second.erase(found);
+                    if (found != pattern_matches.end() && *found == std::pair <size_t, size_t> (begin_pos + pattern_size - 1, pattern_size - 1)) {
+                        res_errors = count_errors<2>(text, text_len, begin_pos,
+                                                  pattern_codes[pattern_id], 0, pattern_size / 3);
+                        pattern_matches.erase(found);
                     } else {
-                        res_errors = count_errors(text, begin_pos,
-                                                  patterns[it->first].first, 0, pattern_size / 3, 1);
+                        res_errors = count_errors<1>(text, text_len, begin_pos,
+                                                  pattern_codes[pattern_id], 0, pattern_size / 3);
                         if (res_errors < 2) {
-                            res_errors += count_errors(text, begin_pos + pattern_size * 2/3,
-                                                      patterns[it->first].first, pattern_size * 2/3, pattern_size - pattern_size * 2/3, 1);
+                            res_errors += count_errors<1>(text, text_len, begin_pos + pattern_size * 2/3,
+                                                      pattern_codes[pattern_id], pattern_size * 2/3, pattern_size - pattern_size * 2/3);
                         } else {
                             ++res_errors;
                         }
                     }
                 } else {
                     begin_pos -= pattern_size/3;
-                    auto found = std::lower_bound(it->second.begin(), it->second.end(),
+                    auto found = std::lower_bound(pattern_matches.begin(), pattern_matches.end(),
                                                   std::pair <size_t, size_t> (begin_pos + pattern_size * 2/3, pattern_size * 2/3));
-                    if (*found == std::pair <size_t, size_t> (begin_pos + pattern_size * 2/3, pattern_size * 2/3)) {
-                        res_errors = count_errors(text, begin_pos + pattern_size / 3,
-                                                  patterns[it->first].first, pattern_size * 2/3, pattern_size - pattern_size * 2/3, 2);
-                        it->second.erase(found);
+                    if (found != pattern_matches.end() && *found == std::pair <size_t, size_t> (begin_pos + pattern_size * 2/3, pattern_size * 2/3)) {
+                        res_errors = count_errors<2>(text, text_len, begin_pos + pattern_size / 3,
+                                                  pattern_codes[pattern_id], pattern_size * 2/3, pattern_size - pattern_size * 2/3);
+                        pattern_matches.erase(found);
                     } else {
-                        found = std::lower_bound(it->second.begin(), it->second.end(),
+                        found = std::lower_bound(pattern_matches.begin(), pattern_matches.end(),
                                                  std::pair <size_t, size_t> (begin_pos + pattern_size - 1, pattern_size - 1));
-                        if (*found == std::pair <size_t, size_t> (begin_pos + pattern_size - 1, pattern_size - 1)) {
-                            res_errors = count_errors(text, begin_pos + pattern_size / 3,
-                                                      patterns[it->first].first, pattern_size / 3, pattern_size * 2/3 - pattern_size * 1/3, 2);
-                            it->second.erase(found);
+                        if (found != pattern_matches.end() && *found == std::pair <size_t, size_t> (begin_pos + pattern_size - 1, pattern_size - 1)) {
+                            res_errors = count_errors<2>(text, text_len, begin_pos + pattern_size / 3,
+                                                      pattern_codes[pattern_id], pattern_size / 3, pattern_size * 2/3 - pattern_size * 1/3);
+                            pattern_matches.erase(found);
                         } else {
-                            res_errors = count_errors(text, begin_pos + pattern_size / 3,
-                                                      patterns[it->first].first, pattern_size / 3, pattern_size * 2/3 - pattern_size * 1/3, 1);
+                            res_errors = count_errors<1>(text, text_len, begin_pos + pattern_size / 3,
+                                                      pattern_codes[pattern_id], pattern_size / 3, pattern_size * 2/3 - pattern_size * 1/3);
                             if (res_errors < 2) {
-                                res_errors += count_errors(text, begin_pos + pattern_size * 2/3,
-                                                          patterns[it->first].first, pattern_size * 2/3, pattern_size - pattern_size * 2/3, 1);
+                                res_errors += count_errors<1>(text, text_len, begin_pos + pattern_size * 2/3,
+                                                          pattern_codes[pattern_id], pattern_size * 2/3, pattern_size - pattern_size * 2/3);
                             } else {
                                 ++res_errors;
                             }
@@ -236,8 +273,12 @@ bool check_partial_matches(std::string const & text,
                     }
                 }
             }
-            it->second.erase(start_match);
+            pattern_matches.erase(start_match);
             if (res_errors <= errors) {
+                if (match) {
+                    match->pattern_id = pattern_id;
+                    match->end = begin_pos + pattern_size - 1;
+                }
                 return true;
             }
         }
@@ -245,38 +286,42 @@ bool check_partial_matches(std::string const & text,
     return false;
 }
 
-Node::Type search_inexact(const std::string & text, Node * root,
-                          std::vector <std::pair<std::string, Node::Type> > const & patterns,
-                          int errors)
+template <int errors>
+Node::Type search_inexact(const unsigned char * text, size_t text_len, Node * root,
+                          std::vector <std::string> const & pattern_codes,
+                          SearchScratch & scratch, Match * match)
 {
-    size_t text_len = text.size();
-    std::map <size_t, std::vector <std::pair <size_t, size_t> > > matches; // value - <text_pos, adapter_pos>
+    scratch.reset(pattern_codes.size());
     Node * curr = root;
     for (size_t i = 0; i < text_len; ++i) {
-        char c = (text[i] > 96) ? text[i] - 32 : text[i];
-        go(curr, c);
-        Node::Type match_type = find_all_matches(curr, i, matches, errors);
+        go(curr, text[i]);
+        Node::Type match_type = find_all_matches<errors>(curr, i, scratch, match);
         if(match_type) {
             return match_type;
         }
     }
-    if (check_partial_matches(text, patterns, matches, errors)) {
+    if (check_partial_matches<errors>(text, text_len, pattern_codes, scratch, match)) {
         return Node::Type::adapter;
     }
     return Node::Type::no_match;
 }
 
-Node::Type search_any(const std::string & text, Node * root)
+Node::Type search_any(const unsigned char * text, size_t text_len, Node * root, Match * match)
 {
-    size_t text_len = text.size();
     Node * curr = root;
     for (size_t i = 0; i < text_len; ++i) {
-        char c = (text[i] > 96) ? text[i] - 32 : text[i];
-        go(curr, c);
-        Node::Type match_type = find_match(curr);
+        go(curr, text[i]);
+        Node::Type match_type = find_match(curr, i, match);
         if(match_type) {
             return match_type;
         }
     }
     return Node::Type::no_match;
 }
+
+template Node::Type search_inexact<1>(const unsigned char * text, size_t text_len, Node * root,
+                                      std::vector <std::string> const & pattern_codes,
+                                      SearchScratch & scratch, Match * match);
+template Node::Type search_inexact<2>(const unsigned char * text, size_t text_len, Node * root,
+                                      std::vector <std::string> const & pattern_codes,
+                                      SearchScratch & scratch, Match * match);
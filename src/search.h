@@ -3,10 +3,13 @@
 
 #include <vector>
 #include <list>
-#include <map>
 #include <string>
 #include <cstddef>
 
+#include "encode.h"
+
+#define SCRATCH_MATCHES_RESERVE 8
+
 class Node
 {
 public:
@@ -19,9 +22,9 @@ public:
         polyC
     };
 
-    Node() : fail(NULL), type(Type::no_match) {}
-    Node(char label) :
-        label(label), fail(NULL), type(Type::no_match)
+    Node() : label(0), fail(NULL), type(Type::no_match), pattern_id(0), children(), delta() {}
+    Node(unsigned char label) :
+        label(label), fail(NULL), type(Type::no_match), pattern_id(0), children(), delta()
     {}
 
     ~Node()
@@ -31,13 +34,9 @@ public:
         }
     }
 
-    Node * next(char c)
+    Node * next(unsigned char c)
     {
-        for (size_t i = 0; i < links.size(); ++i) {
-            if (links[i]->label == c)
-                return links[i];
-        }
-        return NULL;
+        return children[c];
     }
 
     void update_node_stats(Type t, size_t adapt_id, size_t adapt_pos)
@@ -46,24 +45,56 @@ public:
         adapter_id_pos.push_back(std::make_pair(adapt_id, adapt_pos));
     }
 
-    char label;
+    unsigned char label; // base code
     Node * fail;
     Type type;
+    size_t pattern_id; // pattern ending in this node, valid if type is set
     std::list <std::pair <size_t, size_t> > adapter_id_pos;
     std::vector <Node *> links;
+    Node * children[CODES_COUNT]; // links by label
+    Node * delta[CODES_COUNT]; // automaton transitions, filled by add_failures
 };
 
+// Pattern and read position of the match found by a search
+struct Match {
+    Match() : pattern_id(0), end(0) {}
+
+    size_t pattern_id;
+    size_t end; // position of the last matched base
+};
+
+// Per-read working state of the inexact search, reused between reads
+struct SearchScratch {
+    void reset(size_t patterns_count);
+
+    std::vector <std::vector <std::pair<size_t, size_t> > > matches; // by pattern id: <text_pos, adapter_pos>
+    std::vector <size_t> matched_patterns; // ids of patterns with partial matches in the current read
+};
+
+// Position of the first matched base in the read
+size_t match_start(Match const & match, std::vector <std::pair<std::string, Node::Type> > const & patterns);
+
 void build_trie(Node & root,
                 std::vector <std::pair <std::string, Node::Type> > const & patterns,
                 int errors = 0);
 void add_failures(Node & root);
-void go(Node * & curr, char c);
-Node::Type find_match(Node * node);
+inline void go(Node * & curr, unsigned char c)
+{
+    curr = curr->delta[c];
+}
+
+Node::Type find_match(Node * node, size_t pos, Match * match);
+
+// Search functions take reads encoded with encode_seq. Inexact search also
+// needs the encoded patterns. Its kernels are specialized by the maximum
+// error count (1 or 2), instantiations live in search.cpp.
+template <int errors>
 Node::Type find_all_matches(Node * node, size_t pos,
-                      std::map <size_t, std::vector <std::pair<size_t, size_t> > > & matches,
-                      size_t errors);
-Node::Type search_inexact(const std::string & text, Node * root,
-                          std::vector <std::pair<std::string, Node::Type> > const & patterns, int errors);
-Node::Type search_any(const std::string & text, Node * root);
+                      SearchScratch & scratch, Match * match);
+template <int errors>
+Node::Type search_inexact(const unsigned char * text, size_t text_len, Node * root,
+                          std::vector <std::string> const & pattern_codes,
+                          SearchScratch & scratch, Match * match = NULL);
+Node::Type search_any(const unsigned char * text, size_t text_len, Node * root, Match * match = NULL);
 
 #endif // SEARCH_H
@@ -1,18 +1,38 @@
-#include <map>
 #include "seq.h"
 
-std::map <ReadType, std::string> type_names;
+// per thread, so that serve jobs with different options do not mix names
+static thread_local TypeNames own_type_names;
+static thread_local TypeNames const * type_names = NULL;
+
+TypeNames make_type_names(int length, int polyG, int dust_k, int dust_cutoff)
+{
+    TypeNames names;
+    names[ReadType::ok] = "ok";
+    names[ReadType::adapter] = "adapter";
+    names[ReadType::n] = "n";
+    names[ReadType::polyG] = "polyG" + std::to_string(polyG);
+    names[ReadType::polyC] = "polyC" + std::to_string(polyG);
+    names[ReadType::length] = "length" + std::to_string(length);
+    names[ReadType::dust] = "dust" + std::to_string(dust_k) + '_' + std::to_string(dust_cutoff);
+    return names;
+}
+
 void init_type_names(int length, int polyG, int dust_k, int dust_cutoff)
 {
-    type_names[ReadType::ok] = "ok";
-    type_names[ReadType::adapter] = "adapter";
-    type_names[ReadType::n] = "n";
-    type_names[ReadType::polyG] = "polyG" + std::to_string(polyG);
-    type_names[ReadType::polyC] = "polyC" + std::to_string(polyG);
-    type_names[ReadType::length] = "length" + std::to_string(length);
-    type_names[ReadType::dust] = "dust" + std::to_string(dust_k) + '_' + std::to_string(dust_cutoff);
+    own_type_names = make_type_names(length, polyG, dust_k, dust_cutoff);
+    type_names = &own_type_names;
+}
+
+void use_type_names(TypeNames const & names)
+{
+    type_names = &names;
 }
 
 const std::string & get_type_name (ReadType type) {
-    return type_names[type];
+    if (!type_names) {
+        type_names = &own_type_names;
+    }
+    static const std::string unknown;
+    TypeNames::const_iterator it = type_names->find(type);
+    return (it != type_names->end()) ? it->second : unknown;
 }
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <fstream>
+#include <map>
+
+#define SEQ_RESERVE 512
 
 enum ReadType{
     ok,
@@ -14,27 +17,52 @@ enum ReadType{
     dust
 };
 
+#define READ_TYPES_COUNT (ReadType::dust + 1)
+
+// Read type names include filter options, e.g. length50
+typedef std::map <ReadType, std::string> TypeNames;
+
+TypeNames make_type_names(int length, int polyG, int dust_k, int dust_cutoff);
 void init_type_names(int length, int polyG, int dust_k, int dust_cutoff);
+// Makes get_type_name use names owned by the caller, until the next call or init_type_names
+void use_type_names(TypeNames const & names);
 const std::string & get_type_name (ReadType type);
 
 class Seq {
 public:
-    Seq() {}
+    Seq() : truncated(false)
+    {
+        id.reserve(SEQ_RESERVE);
+        seq.reserve(SEQ_RESERVE);
+        qual.reserve(SEQ_RESERVE);
+        tmp.reserve(SEQ_RESERVE);
+    }
 
+    // Strings keep their capacity, so reusing one Seq for all reads
+    // does not allocate once the longest read has been seen.
+    // Blank lines between records are skipped. Returns false at the end of
+    // the input or at a record cut short, which is_truncated() tells apart.
     bool read_seq(std::ifstream & fin)
     {
-        std::string tmp;
-        std::getline(fin, id);
+        do {
+            std::getline(fin, id);
+        } while (fin && id.empty());
         if (!fin) {
             return false;
         }
         std::getline(fin, seq);
         std::getline(fin, tmp);
         std::getline(fin, qual);
-        return true;
+        truncated = !fin;
+        return !truncated;
+    }
+
+    bool is_truncated() const
+    {
+        return truncated;
     }
 
-    void write_seq(std::ofstream & fout)
+    void write_seq(std::ostream & fout)
     {
         fout << id << '\n';
         fout << seq << '\n';
@@ -42,9 +70,24 @@ public:
         fout << qual << '\n';
     }
 
-    void update_id(ReadType type)
+    // Size of the record written by write_seq
+    size_t record_size() const
+    {
+        return id.size() + seq.size() + qual.size() + 5;
+    }
+
+    // Writes the record with the reason name in the id, e.g. @adapter__read1,
+    // but leaves the read unchanged
+    void write_seq(std::ostream & fout, std::string const & reason)
+    {
+        fout << id[0] << reason << "__";
+        fout.write(id.data() + 1, id.size() - 1);
+        fout << '\n' << seq << '\n' << '+' << '\n' << qual << '\n';
+    }
+
+    void write_seq(std::ostream & fout, ReadType type)
     {
-        id.insert(1, get_type_name(type) + "__");
+        write_seq(fout, get_type_name(type));
     }
 
     std::string const & get_seq() const
@@ -56,6 +99,8 @@ private:
     std::string id;
     std::string seq;
     std::string qual;
+    std::string tmp;
+    bool truncated; // the last record read was cut short
 };
 
 #endif // SEQ_H
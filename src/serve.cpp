@@ -0,0 +1,422 @@
+#include "serve.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <cstring>
+#include <cstdlib>
+#include <exception>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "rm_reads.h"
+
+#define MAX_JOB_SIZE 65536
+
+// Compiled filters by kmers file and filter options. Only filters of the
+// current version of a kmers file are kept: when its modification time
+// changes, the filters compiled from the older version are dropped, and
+// jobs still running with them keep their own references.
+class FilterCache
+{
+public:
+    std::shared_ptr <ReadFilter const> get(std::string const & kmers, FilterConfig const & config, std::ostream & err)
+    {
+        struct stat kmers_stat;
+        if (stat(kmers.c_str(), &kmers_stat) != 0) {
+            err << "Cannot open kmers file" << std::endl;
+            return std::shared_ptr <ReadFilter const>();
+        }
+        char real_path[PATH_MAX];
+        if (!realpath(kmers.c_str(), real_path)) {
+            err << "Cannot open kmers file" << std::endl;
+            return std::shared_ptr <ReadFilter const>();
+        }
+        std::ostringstream key;
+        key << config.length << '\t' << config.polyG << '\t' << config.dust_k << '\t' << config.dust_cutoff
+            << '\t' << config.errors << '\t' << config.filterN << '\t' << window_name(config.window);
+
+        // the first job with a key compiles the filter without holding the
+        // lock, later jobs with the same key wait for its result
+        std::shared_future <Compiled> compiled;
+        std::promise <Compiled> promise;
+        bool compile = false;
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            KmersFile & file = files[real_path];
+            if (file.mtime != kmers_stat.st_mtime) {
+                file.mtime = kmers_stat.st_mtime;
+                file.filters.clear();
+            }
+            auto it = file.filters.find(key.str());
+            if (it != file.filters.end()) {
+                compiled = it->second;
+            } else {
+                compiled = promise.get_future().share();
+                file.filters[key.str()] = compiled;
+                compile = true;
+            }
+        }
+
+        if (compile) {
+            std::ostringstream compile_err;
+            std::shared_ptr <ReadFilter const> filter;
+            try {
+                filter.reset(compile_filter(kmers, config, compile_err));
+            } catch (std::exception const & e) {
+                compile_err << "Cannot compile filter: " << e.what() << std::endl;
+            }
+            if (!filter) {
+                // not cached, so that the job can be retried after fixing the kmers file
+                std::lock_guard <std::mutex> lock(mutex);
+                KmersFile & file = files[real_path];
+                if (file.mtime == kmers_stat.st_mtime) {
+                    file.filters.erase(key.str());
+                }
+            }
+            promise.set_value(Compiled(filter, compile_err.str()));
+        }
+
+        Compiled const & result = compiled.get();
+        err << result.second;
+        return result.first;
+    }
+
+private:
+    // filter, or NULL and the compile errors
+    typedef std::pair <std::shared_ptr <ReadFilter const>, std::string> Compiled;
+
+    struct KmersFile {
+        KmersFile() : mtime(0) {}
+
+        time_t mtime; // of the version the filters were compiled from
+        std::map <std::string, std::shared_future <Compiled> > filters; // by filter options
+    };
+
+    std::mutex mutex;
+    std::map <std::string, KmersFile> files; // by real path
+};
+
+// Accepted connections waiting for a worker
+class JobQueue
+{
+public:
+    void push(int fd)
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        fds.push(fd);
+        ready.notify_one();
+    }
+
+    int pop()
+    {
+        std::unique_lock <std::mutex> lock(mutex);
+        while (fds.empty()) {
+            ready.wait(lock);
+        }
+        int fd = fds.front();
+        fds.pop();
+        return fd;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::queue <int> fds;
+};
+
+static FilterCache cache;
+static JobQueue jobs;
+// getopt keeps global state, so jobs are parsed one at a time
+static std::mutex parse_mutex;
+static char socket_path[sizeof(((sockaddr_un *)0)->sun_path)];
+
+static bool send_all(int fd, std::string const & data)
+{
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t res = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (res <= 0) {
+            return false;
+        }
+        sent += res;
+    }
+    return true;
+}
+
+static bool receive_line(int fd, std::string & line)
+{
+    char buf[4096];
+    line.clear();
+    while (line.size() < MAX_JOB_SIZE) {
+        ssize_t res = recv(fd, buf, sizeof(buf), 0);
+        if (res <= 0) {
+            return !line.empty();
+        }
+        line.append(buf, res);
+        size_t end = line.find('\n');
+        if (end != std::string::npos) {
+            line.erase(end);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Arguments of a job are separated by spaces or tabs. A backslash escapes
+// the next character and "\\n" stands for a newline, so arguments may hold
+// any character.
+static std::string escape_arg(std::string const & arg)
+{
+    std::string res;
+    for (auto it = arg.begin(); it != arg.end(); ++it) {
+        if (*it == '\n') {
+            res += "\\n";
+            continue;
+        }
+        if (*it == ' ' || *it == '\t' || *it == '\\') {
+            res += '\\';
+        }
+        res += *it;
+    }
+    return res;
+}
+
+static void split_job(std::string const & job, std::vector <std::string> & args)
+{
+    std::string arg;
+    bool in_arg = false;
+    for (size_t i = 0; i < job.size(); ++i) {
+        char c = job[i];
+        if (c == ' ' || c == '\t') {
+            if (in_arg) {
+                args.push_back(arg);
+                arg.clear();
+                in_arg = false;
+            }
+            continue;
+        }
+        if (c == '\\' && i + 1 < job.size()) {
+            c = job[++i];
+            if (c == 'n') {
+                c = '\n';
+            }
+        }
+        arg += c;
+        in_arg = true;
+    }
+    if (in_arg) {
+        args.push_back(arg);
+    }
+}
+
+static int run_job(std::string const & job, std::ostream & out, std::ostream & err)
+{
+    std::vector <std::string> args(1, "rm_reads");
+    split_job(job, args);
+    std::vector <char *> argv;
+    for (auto it = args.begin(); it != args.end(); ++it) {
+        argv.push_back(&(*it)[0]);
+    }
+    argv.push_back(NULL);
+
+    FilterOptions options;
+    {
+        std::lock_guard <std::mutex> lock(parse_mutex);
+        if (parse_options((int)args.size(), &argv[0], options, err)) {
+            return -1;
+        }
+    }
+
+    if (!options.rejects.empty()) {
+        return rebuild_filtered(options, err);
+    }
+
+    ProfileSet filters;
+    std::vector <std::shared_ptr <ReadFilter const> > compiled;
+    for (auto it = options.profiles.begin(); it != options.profiles.end(); ++it) {
+        std::shared_ptr <ReadFilter const> filter = cache.get(options.kmers, it->config, err);
+        if (!filter) {
+            return -1;
+        }
+        compiled.push_back(filter);
+        filters.add(filter.get());
+    }
+    return run_filter(options, filters, out, err);
+}
+
+static void worker()
+{
+    while (true) {
+        int fd = jobs.pop();
+        std::string job;
+        if (receive_line(fd, job)) {
+            std::ostringstream out;
+            std::ostringstream err;
+            int res;
+            // an exception would end the whole server, not only this job
+            try {
+                res = run_job(job, out, err);
+            } catch (std::exception const & e) {
+                err << "Job failed: " << e.what() << std::endl;
+                res = -1;
+            }
+            out << err.str() << "status " << res << "\n";
+            send_all(fd, out.str());
+        }
+        close(fd);
+    }
+}
+
+static void stop_server(int)
+{
+    unlink(socket_path);
+    _exit(0);
+}
+
+static int make_address(std::string const & path, sockaddr_un & addr)
+{
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path is too long" << std::endl;
+        return -1;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    return 0;
+}
+
+int serve(int argc, char ** argv)
+{
+    std::string path;
+    int threads = std::thread::hardware_concurrency();
+    char rez = 0;
+
+    const struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"socket", required_argument, NULL, 'S'},
+        {"threads", required_argument, NULL, 't'},
+        {NULL,0,NULL,0}
+    };
+
+    optind = 0;
+    while ((rez = getopt_long(argc, argv, "hS:t:", long_options, NULL)) != -1) {
+        switch (rez) {
+        case 'S':
+            path = optarg;
+            break;
+        case 't':
+            threads = std::atoi(optarg);
+            break;
+        case '?':
+        case 'h':
+            print_help(std::cerr);
+            return -1;
+        }
+    }
+
+    if (path.empty()) {
+        std::cerr << "Please, specify socket path" << std::endl;
+        print_help(std::cerr);
+        return -1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    sockaddr_un addr;
+    if (make_address(path, addr)) {
+        return -1;
+    }
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (server_fd < 0 || bind(server_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(server_fd, SOMAXCONN) != 0) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    std::strcpy(socket_path, path.c_str());
+    // job option errors are answered with the usage text, not logged by getopt
+    opterr = 0;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    for (int i = 0; i < threads; ++i) {
+        std::thread(worker).detach();
+    }
+    std::cerr << "Listening on " << path << " with " << threads << " workers" << std::endl;
+
+    while (true) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Cannot accept connection: " << std::strerror(errno) << std::endl;
+            return -1;
+        }
+        jobs.push(fd);
+    }
+}
+
+int submit(int argc, char ** argv)
+{
+    if (argc < 2) {
+        print_help(std::cerr);
+        return -1;
+    }
+
+    sockaddr_un addr;
+    if (make_address(argv[1], addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Cannot connect to " << argv[1] << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+
+    char cwd[PATH_MAX];
+    std::string job = "--workdir ";
+    job += escape_arg(getcwd(cwd, sizeof(cwd)) ? cwd : ".");
+    for (int i = 2; i < argc; ++i) {
+        job += ' ';
+        job += escape_arg(argv[i]);
+    }
+    job += '\n';
+    if (!send_all(fd, job)) {
+        std::cerr << "Cannot send job" << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    std::string reply;
+    char buf[4096];
+    ssize_t res;
+    while ((res = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        reply.append(buf, res);
+    }
+    close(fd);
+
+    size_t status_pos = reply.rfind("status ");
+    if (status_pos == std::string::npos) {
+        std::cerr << "Server closed connection without reply" << std::endl;
+        return -1;
+    }
+    int status = std::atoi(reply.c_str() + status_pos + 7);
+    (status ? std::cerr : std::cout) << reply.substr(0, status_pos);
+    return status;
+}
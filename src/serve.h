@@ -0,0 +1,15 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+// Resident mode: keeps compiled filters in memory and runs filter jobs
+// received on a Unix socket. A job is one line with the usual filter
+// options separated by spaces, spaces, tabs and backslashes in an option are
+// escaped with a backslash and newlines written as "\n". The reply is the
+// reads statistics and error messages, followed by the line "status <exit code>".
+int serve(int argc, char ** argv);
+
+// Sends a filter job to a running server and prints the reply. Relative
+// paths are resolved against the current directory of the client.
+int submit(int argc, char ** argv);
+
+#endif // SERVE_H
@@ -0,0 +1,82 @@
+#include "shards.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+std::string ShardedOutput::shard_name(size_t index) const
+{
+    if (!split()) {
+        return prefix + ".fastq";
+    }
+    char number[32];
+    std::snprintf(number, sizeof(number), "%04zu", index);
+    return prefix + "." + number + ".fastq";
+}
+
+bool ShardedOutput::open()
+{
+    shards.push_back(std::make_pair(shard_name(1), 0));
+    out.open(shards.back().first.c_str(), std::ofstream::out);
+    return out.good();
+}
+
+bool ShardedOutput::next_shard()
+{
+    close();
+    reads = 0;
+    bytes = 0;
+    shards.push_back(std::make_pair(shard_name(shards.size() + 1), 0));
+    out.open(shards.back().first.c_str(), std::ofstream::out);
+    return out.good();
+}
+
+void ShardedOutput::close()
+{
+    if (out.is_open()) {
+        shards.back().second = reads;
+        out.close();
+    }
+}
+
+bool ShardedOutput::write_manifest(std::string const & path) const
+{
+    std::ofstream manifest_f(path.c_str(), std::ofstream::out);
+    manifest_f << "#file\treads" << std::endl;
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+        size_t pos = it->first.find_last_of('/');
+        manifest_f << (pos == std::string::npos ? it->first : it->first.substr(pos + 1))
+                   << "\t" << it->second << "\n";
+    }
+    return manifest_f.good();
+}
+
+bool parse_shard_size(std::string const & value, size_t & shard_reads, size_t & shard_bytes)
+{
+    char * end = NULL;
+    unsigned long long size = std::strtoull(value.c_str(), &end, 10);
+    if (end == value.c_str() || size == 0) {
+        return false;
+    }
+    shard_reads = 0;
+    shard_bytes = 0;
+    switch (*end) {
+    case '\0':
+        shard_reads = size;
+        return true;
+    case 'K':
+    case 'k':
+        shard_bytes = size << 10;
+        break;
+    case 'M':
+    case 'm':
+        shard_bytes = size << 20;
+        break;
+    case 'G':
+    case 'g':
+        shard_bytes = size << 30;
+        break;
+    default:
+        return false;
+    }
+    return end[1] == '\0';
+}
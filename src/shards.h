@@ -0,0 +1,64 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "seq.h"
+
+// Output for kept reads, optionally split into numbered shards of limited
+// size. Without limits all reads go to prefix.fastq, otherwise to
+// prefix.0001.fastq, prefix.0002.fastq and so on.
+class ShardedOutput
+{
+public:
+    ShardedOutput(std::string const & prefix, size_t shard_reads = 0, size_t shard_bytes = 0)
+        : prefix(prefix), shard_reads(shard_reads), shard_bytes(shard_bytes), reads(0), bytes(0) {}
+
+    bool split() const
+    {
+        return shard_reads || shard_bytes;
+    }
+
+    // Tells whether the read does not fit into the current shard. A read
+    // larger than the byte limit still goes alone into an empty shard.
+    bool full(Seq const & read) const
+    {
+        return (shard_reads && reads >= shard_reads) ||
+               (shard_bytes && bytes && bytes + read.record_size() > shard_bytes);
+    }
+
+    // Opens the first shard, or the single output file if not split
+    bool open();
+    // Closes the current shard and opens the next one
+    bool next_shard();
+    void close();
+
+    void write(Seq & read)
+    {
+        read.write_seq(out);
+        ++reads;
+        bytes += read.record_size();
+    }
+
+    // Writes shard file names and read counts, one shard per line
+    bool write_manifest(std::string const & path) const;
+
+private:
+    std::string shard_name(size_t index) const;
+
+    std::string prefix;
+    size_t shard_reads;
+    size_t shard_bytes;
+    size_t reads;
+    size_t bytes;
+    std::ofstream out;
+    std::vector <std::pair<std::string, size_t> > shards;
+};
+
+// Parses shard size given as reads count or as bytes with K, M or G suffix
+bool parse_shard_size(std::string const & value, size_t & shard_reads, size_t & shard_bytes);
+
+#endif // SHARDS_H
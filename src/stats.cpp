@@ -1,13 +1,10 @@
 #include "stats.h"
 
+#include <algorithm>
+
 void Stats::update(ReadType type, bool paired)
 {
-    auto it = reads.find(type);
-    if (it == reads.end()) {
-        reads[type] = 1;
-    } else {
-        ++it->second;
-    }
+    ++reads[type];
     ++complete;
     if (type == ReadType::ok) {
         if (paired) {
@@ -22,10 +19,13 @@ std::ostream & operator << (std::ostream & out, const Stats & stats)
 {
     out << stats.filename << std::endl;
     unsigned int bad = 0;
-    for (auto it = stats.reads.begin(); it != stats.reads.end(); ++it) {
-        out << "\t" << get_type_name(it->first) << "\t" << it->second << std::endl;
-        if (it->first != ReadType::ok) {
-            bad += it->second;
+    for (int type = 0; type < READ_TYPES_COUNT; ++type) {
+        if (!stats.reads[type]) {
+            continue;
+        }
+        out << "\t" << get_type_name((ReadType)type) << "\t" << stats.reads[type] << std::endl;
+        if (type != ReadType::ok) {
+            bad += stats.reads[type];
         }
     }
     out << "\t" << "fraction " << (double)(stats.complete - bad)/stats.complete << std::endl;
@@ -35,3 +35,32 @@ std::ostream & operator << (std::ostream & out, const Stats & stats)
     }
     return out;
 }
+
+void MatchStats::update(Match const & match, std::vector <std::pair<std::string, Node::Type> > const & patterns)
+{
+    size_t bin = std::min(match_start(match, patterns), (size_t)MATCH_POSITION_BINS - 1);
+    ++hits[match.pattern_id];
+    ++positions[match.pattern_id * MATCH_POSITION_BINS + bin];
+}
+
+void MatchStats::write_tsv(std::ostream & out, std::vector <std::pair<std::string, Node::Type> > const & patterns) const
+{
+    out << "#id\tpattern\ttype\thits\tpositions" << std::endl;
+    for (size_t i = 0; i < hits.size(); ++i) {
+        out << i << "\t" << patterns[i].first << "\t" << get_type_name((ReadType)patterns[i].second)
+            << "\t" << hits[i] << "\t";
+        bool first = true;
+        unsigned int const * histogram = &positions[i * MATCH_POSITION_BINS];
+        for (size_t pos = 0; pos < MATCH_POSITION_BINS; ++pos) {
+            if (histogram[pos]) {
+                out << (first ? "" : ",") << pos << (pos == MATCH_POSITION_BINS - 1 ? "+" : "")
+                    << ":" << histogram[pos];
+                first = false;
+            }
+        }
+        if (first) {
+            out << "-";
+        }
+        out << "\n";
+    }
+}
@@ -1,24 +1,25 @@
 #ifndef STATS_H
 #define STATS_H
 
-#include <map>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "seq.h"
+#include "search.h"
 
 class Stats
 {
 public:
-    Stats() {}
-    Stats(std::string const & filename) : filename(filename), complete(0), pe(0), se(0) {}
+    Stats() : reads(), complete(0), pe(0), se(0) {}
+    Stats(std::string const & filename) : filename(filename), reads(), complete(0), pe(0), se(0) {}
 
     void update(ReadType type, bool paired = false);
 
     friend std::ostream & operator << (std::ostream & out, const Stats & stats);
 
     std::string filename;
-    std::map <ReadType, unsigned int> reads;
+    unsigned int reads[READ_TYPES_COUNT];
     unsigned int complete;
     unsigned int pe;
     unsigned int se;
@@ -26,4 +27,22 @@ public:
 
 std::ostream & operator << (std::ostream & out, const Stats & stats);
 
+#define MATCH_POSITION_BINS 512 // the last bin counts all later match starts
+
+// Per-pattern hit counts and histograms of match start positions in reads,
+// one for every input file of a filter run. Histograms are allocated up
+// front, so counting a match does not touch the heap.
+class MatchStats
+{
+public:
+    MatchStats() {}
+    MatchStats(size_t patterns_count) : hits(patterns_count), positions(patterns_count * MATCH_POSITION_BINS) {}
+
+    void update(Match const & match, std::vector <std::pair<std::string, Node::Type> > const & patterns);
+    void write_tsv(std::ostream & out, std::vector <std::pair<std::string, Node::Type> > const & patterns) const;
+
+    std::vector <unsigned int> hits;
+    std::vector <unsigned int> positions; // MATCH_POSITION_BINS by pattern
+};
+
 #endif // STATS_H